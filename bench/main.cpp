@@ -0,0 +1,452 @@
+/*
+ * This is the entry point of wondercard-bench, which measures the throughput
+ * of the protocol implementation and writes the results out as JSON, so that
+ * results from different versions can be compared against one another.
+ *
+ * Usage: wondercard-bench [--filter=<text>] [--min-time=<seconds>] [--output=<file>]
+ */
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+#include <wondercard/CardDirectory.hpp>
+#include <wondercard/CardImage.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
+#include <wondercard/PagedCardStorage.hpp>
+#include <wondercard/ProtocolDecoder.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+#include <wondercard/TraceReplayer.hpp>
+
+
+using namespace com::saxbophone::wondercard;
+
+namespace {
+    struct Result {
+        std::string name;
+        std::uint64_t iterations;
+        double ns_per_op;
+        std::size_t bytes_per_op; // protocol bytes or data bytes processed per operation
+    };
+
+    /*
+     * Runs each benchmark for at least the minimum time, doubling the number
+     * of iterations until it does, and collects the results
+     */
+    class Runner {
+    public:
+        Runner(std::string_view filter, double min_time)
+          : _filter(filter)
+          , _min_time(min_time)
+          {}
+
+        template <typename Operation>
+        void run(std::string_view name, std::size_t bytes_per_op, Operation operation) {
+            if (name.find(this->_filter) == std::string_view::npos) {
+                return;
+            }
+            operation(); // warm-up
+            std::uint64_t iterations = 1;
+            while (true) {
+                auto start = std::chrono::steady_clock::now();
+                for (std::uint64_t i = 0; i < iterations; i++) {
+                    operation();
+                }
+                std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                if (elapsed.count() >= this->_min_time) {
+                    this->_results.push_back({
+                        std::string(name),
+                        iterations,
+                        elapsed.count() * 1e9 / (double)iterations,
+                        bytes_per_op,
+                    });
+                    std::cerr << name << ": " << this->_results.back().ns_per_op << " ns/op" << std::endl;
+                    return;
+                }
+                iterations *= 2;
+            }
+        }
+
+        void write_json(std::ostream& output) const {
+            output << "{\n";
+            output << "  \"context\": {\n";
+            output << "    \"library\": \"wondercard\",\n";
+            output << "    \"version\": \"" << PROJECT_VERSION_STRING << "\",\n";
+            output << "    \"build_type\": \"" << WONDERCARD_BUILD_TYPE << "\",\n";
+            output << "    \"min_time\": " << this->_min_time << "\n";
+            output << "  },\n";
+            output << "  \"benchmarks\": [";
+            for (std::size_t i = 0; i < this->_results.size(); i++) {
+                const Result& result = this->_results[i];
+                double ns_per_byte = result.ns_per_op / (double)result.bytes_per_op;
+                output << (i == 0 ? "\n" : ",\n");
+                output << "    {";
+                output << "\"name\": \"" << result.name << "\", ";
+                output << "\"iterations\": " << result.iterations << ", ";
+                output << "\"ns_per_op\": " << result.ns_per_op << ", ";
+                output << "\"bytes_per_op\": " << result.bytes_per_op << ", ";
+                output << "\"ns_per_byte\": " << ns_per_byte << ", ";
+                output << "\"bytes_per_second\": " << 1e9 / ns_per_byte;
+                output << "}";
+            }
+            output << "\n  ]\n";
+            output << "}\n";
+        }
+
+    private:
+        std::string_view _filter;
+        double _min_time;
+        std::vector<Result> _results;
+    };
+
+    // stops the results of the operations being benchmarked from being optimised out
+    volatile std::size_t sink;
+
+    // sends the given sequence of commands with send(), one at a time
+    template <std::size_t SIZE>
+    void send_all(MemoryCard& card, const std::array<TriState, SIZE>& commands) {
+        TriState response;
+        std::size_t acks = 0;
+        for (TriState command : commands) {
+            acks += card.send(command, response);
+        }
+        sink = acks;
+    }
+
+    // builds the command sequence for a full read sector transaction
+    std::array<TriState, 140> read_sector_commands(std::uint16_t sector) {
+        std::array<TriState, 140> commands;
+        commands.fill(0x00);
+        commands[0] = 0x81;
+        commands[1] = 0x52;
+        commands[4] = (Byte)(sector >> 8);
+        commands[5] = (Byte)(sector & 0x00FF);
+        return commands;
+    }
+
+    // builds the command sequence for a full write sector transaction
+    std::array<TriState, 138> write_sector_commands(std::uint16_t sector) {
+        std::array<TriState, 138> commands;
+        commands.fill(0x00);
+        commands[0] = 0x81;
+        commands[1] = 0x57;
+        commands[4] = (Byte)(sector >> 8);
+        commands[5] = (Byte)(sector & 0x00FF);
+        // zero data, so the checksum is just that of the address
+        commands[134] = (Byte)(sector >> 8) ^ (Byte)(sector & 0x00FF);
+        return commands;
+    }
+
+    void benchmark_send(Runner& runner) {
+        MemoryCard card;
+        card.power_on();
+        runner.run("MemoryCard/send/ignored_command", 1, [&] {
+            send_all(card, std::array<TriState, 1>{0x01});
+        });
+        runner.run("MemoryCard/send/invalid_command", 2, [&] {
+            send_all(card, std::array<TriState, 2>{0x81, 0x33});
+        });
+        runner.run("MemoryCard/send/get_id", 10, [&] {
+            send_all(card, std::array<TriState, 10>{0x81, 0x53, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
+        });
+        runner.run("MemoryCard/send/read_invalid_sector", 10, [&] {
+            send_all(card, std::array<TriState, 10>{0x81, 0x52, 0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00});
+        });
+        auto read_commands = read_sector_commands(0x115);
+        runner.run("MemoryCard/send/read_sector", read_commands.size(), [&] {
+            send_all(card, read_commands);
+        });
+        auto write_commands = write_sector_commands(0x115);
+        runner.run("MemoryCard/send/write_sector", write_commands.size(), [&] {
+            send_all(card, write_commands);
+        });
+    }
+
+    void benchmark_transfer(Runner& runner) {
+        MemoryCard card;
+        card.power_on();
+        std::array<TriState, 140> responses;
+        std::array<bool, 140> acks;
+        auto read_commands = read_sector_commands(0x115);
+        runner.run("MemoryCard/transfer/read_sector", read_commands.size(), [&] {
+            sink = card.transfer(read_commands, responses, acks);
+        });
+        auto write_commands = write_sector_commands(0x115);
+        runner.run("MemoryCard/transfer/write_sector", write_commands.size(), [&] {
+            sink = card.transfer(write_commands, responses, acks);
+        });
+    }
+
+    void benchmark_slot(Runner& runner, bool direct) {
+        std::string prefix = direct ? "MemoryCardSlot/direct/" : "MemoryCardSlot/";
+        auto card = std::make_unique<MemoryCard>();
+        MemoryCardSlot slot;
+        slot.set_direct_mode(direct);
+        slot.insert_card(*card);
+        auto data = std::make_unique<std::array<Byte, MemoryCard::CARD_SIZE>>();
+        MemoryCard::Sector sector(data->data(), MemoryCard::SECTOR_SIZE);
+        MemoryCard::Block block(data->data(), MemoryCard::BLOCK_SIZE);
+        runner.run(prefix + "read_sector", MemoryCard::SECTOR_SIZE, [&] {
+            sink = (bool)slot.read_sector(0x115, sector);
+        });
+        runner.run(prefix + "write_sector", MemoryCard::SECTOR_SIZE, [&] {
+            sink = (bool)slot.write_sector(0x115, sector);
+        });
+        runner.run(prefix + "read_block", MemoryCard::BLOCK_SIZE, [&] {
+            sink = (bool)slot.read_block(0x5, block);
+        });
+        runner.run(prefix + "write_block", MemoryCard::BLOCK_SIZE, [&] {
+            sink = (bool)slot.write_block(0x5, block);
+        });
+        runner.run(prefix + "read_card", MemoryCard::CARD_SIZE, [&] {
+            sink = (bool)slot.read_card(*data);
+        });
+        runner.run(prefix + "write_card", MemoryCard::CARD_SIZE, [&] {
+            sink = (bool)slot.write_card(*data);
+        });
+        // a typical save, which changes a single Block
+        auto changed = std::make_unique<std::array<Byte, MemoryCard::CARD_SIZE>>(*data);
+        std::fill_n(changed->begin() + 5 * MemoryCard::BLOCK_SIZE, MemoryCard::BLOCK_SIZE, (Byte)0x55);
+        runner.run(prefix + "write_card_delta", MemoryCard::CARD_SIZE, [&] {
+            sink = (bool)slot.write_card_delta(*changed, *data);
+        });
+    }
+
+    void benchmark_trace(Runner& runner) {
+        MemoryCard card;
+        MemoryCardSlot slot;
+        slot.insert_card(card);
+        ProtocolTrace trace(1024);
+        std::array<ProtocolTrace::Record, 1024> records;
+        slot.set_trace(&trace);
+        std::array<Byte, MemoryCard::SECTOR_SIZE> sector = {};
+        runner.run("MemoryCardSlot/traced/read_sector", MemoryCard::SECTOR_SIZE, [&] {
+            sink = (bool)slot.read_sector(0x115, sector);
+            sink = trace.drain(records);
+        });
+    }
+
+    void benchmark_cache(Runner& runner) {
+        MemoryCard card;
+        MemoryCardSlot slot;
+        slot.set_cache_capacity(64);
+        slot.insert_card(card);
+        std::array<Byte, MemoryCard::SECTOR_SIZE> sector = {};
+        runner.run("MemoryCardSlot/cached/read_sector", MemoryCard::SECTOR_SIZE, [&] {
+            sink = (bool)slot.read_sector(0x115, sector);
+        });
+    }
+
+    void benchmark_directory(Runner& runner) {
+        // a card full of one-Block saves, looking up the last one
+        MemoryCard card;
+        for (std::size_t block = 1; block <= CardDirectory::FRAME_COUNT; block++) {
+            auto frame = card.get_sector(block);
+            frame[0] = 0x51;
+            frame[8] = 0xFF;
+            frame[9] = 0xFF;
+            std::string name = "BASLUS-000" + std::to_string(block + 10);
+            std::copy(name.begin(), name.end(), frame.begin() + 0x0A);
+        }
+        CardDirectory directory(card);
+        runner.run("CardDirectory/find", 1, [&] {
+            sink = directory.find("BASLUS-00025")->blocks[0];
+        });
+        // copying a one-Block save off the card, against reading it through a slot
+        std::array<Byte, MemoryCard::BLOCK_SIZE> save = {};
+        runner.run("CardDirectory/export_save", MemoryCard::BLOCK_SIZE, [&] {
+            directory.export_save(*directory.find("BASLUS-00025")).copy_to(save);
+            sink = save[0];
+        });
+    }
+
+    void benchmark_image(Runner& runner) {
+        MemoryCard card;
+        std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+        CardImage::write(stream, card, CardImage::Format::GME);
+        std::string image = stream.str();
+        runner.run("CardImage/sniff", CardImage::SNIFF_SIZE, [&] {
+            sink = (std::size_t)CardImage::sniff(std::span<const Byte>((const Byte*)image.data(), CardImage::SNIFF_SIZE));
+        });
+        runner.run("CardImage/read/gme", MemoryCard::CARD_SIZE, [&] {
+            stream.clear();
+            stream.seekg(0);
+            sink = CardImage::read(stream, card);
+        });
+    }
+
+    void benchmark_replay(Runner& runner) {
+        // reading leaves the card as it was, so the same trace can be replayed over and over
+        MemoryCard card;
+        MemoryCardSlot slot;
+        slot.insert_card(card);
+        ProtocolTrace trace(16384);
+        slot.set_trace(&trace);
+        std::array<Byte, MemoryCard::BLOCK_SIZE> block = {};
+        slot.read_block(3, block);
+        std::vector<ProtocolTrace::Record> records(trace.capacity());
+        records.resize(trace.drain(records));
+        runner.run("TraceReplayer/replay", records.size(), [&] {
+            TraceReplayer replayer(card);
+            sink = replayer.replay(records);
+        });
+    }
+
+    void benchmark_decoder(Runner& runner) {
+        MemoryCard card;
+        MemoryCardSlot slot;
+        slot.insert_card(card);
+        ProtocolTrace trace(32768);
+        slot.set_trace(&trace);
+        std::array<Byte, MemoryCard::BLOCK_SIZE> block = {};
+        slot.read_block(3, block);
+        slot.write_block(4, block);
+        std::vector<ProtocolTrace::Record> records(trace.capacity());
+        records.resize(trace.drain(records));
+        ProtocolDecoder decoder;
+        runner.run("ProtocolDecoder/decode", records.size(), [&] {
+            std::size_t events = 0;
+            decoder.decode(records, [&](const ProtocolDecoder::Event&) { events++; });
+            sink = events;
+        });
+    }
+
+    /*
+     * measures the per-byte cost of the bulk operations done on buffers of
+     * tri-state bytes, for the given tri-state type
+     */
+    template <typename T>
+    void benchmark_tristate_buffers(Runner& runner, std::string prefix) {
+        constexpr std::size_t SIZE = 4096;
+        std::vector<T> sent(SIZE), received(SIZE);
+        for (std::size_t i = 0; i < SIZE; i++) {
+            // every 8th byte is High-Z
+            if (i % 8 != 7) {
+                sent[i] = (Byte)i;
+                received[i] = (Byte)i;
+            }
+        }
+        runner.run(prefix + "compare", SIZE, [&] {
+            std::size_t matches = 0;
+            for (std::size_t i = 0; i < SIZE; i++) {
+                matches += sent[i] == received[i];
+            }
+            sink = matches;
+        });
+        runner.run(prefix + "value_or", SIZE, [&] {
+            std::size_t total = 0;
+            for (const T& byte : received) {
+                total += byte.value_or(0xFF);
+            }
+            sink = total;
+        });
+        runner.run(prefix + "copy", SIZE, [&] {
+            std::copy(sent.begin(), sent.end(), received.begin());
+            sink = received[SIZE / 2].has_value();
+        });
+    }
+
+    void benchmark_snapshot(Runner& runner) {
+        MemoryCard card;
+        card.power_on();
+        std::array<Byte, MemoryCard::MACHINE_STATE_SIZE> state;
+        runner.run("MemoryCard/serialize/machine_state", MemoryCard::MACHINE_STATE_SIZE, [&] {
+            sink = card.serialize(state);
+        });
+        runner.run("MemoryCard/deserialize/machine_state", MemoryCard::MACHINE_STATE_SIZE, [&] {
+            sink = card.deserialize(state);
+        });
+        // a frame's worth of save-state with a single sector written
+        auto buffer = std::make_unique<std::array<Byte, MemoryCard::MACHINE_STATE_SIZE + MemoryCard::CARD_SIZE>>();
+        std::size_t size = card.snapshot_size(MemoryCard::SnapshotMode::DIRTY_SINCE_BASE) + MemoryCard::SECTOR_SIZE;
+        runner.run("MemoryCard/serialize/dirty_sector", size, [&] {
+            card.mark_dirty(0x115);
+            sink = card.serialize(*buffer, MemoryCard::SnapshotMode::DIRTY_SINCE_BASE);
+        });
+        runner.run("MemoryCard/serialize/full", MemoryCard::MACHINE_STATE_SIZE + MemoryCard::CARD_SIZE, [&] {
+            sink = card.serialize(*buffer, MemoryCard::SnapshotMode::FULL);
+        });
+    }
+
+    void benchmark_construction(Runner& runner) {
+        runner.run("MemoryCard/construct/default", MemoryCard::CARD_SIZE, [] {
+            auto card = std::make_unique<MemoryCard>();
+            sink = card->bytes()[0];
+        });
+        runner.run("MemoryCard/construct/paged", MemoryCard::CARD_SIZE, [] {
+            auto card = std::make_unique<MemoryCard>(std::make_unique<PagedCardStorage>());
+            sink = card->bytes()[0];
+        });
+        auto data = std::make_unique<std::array<Byte, MemoryCard::CARD_SIZE>>();
+        runner.run("MemoryCard/construct/from_data", MemoryCard::CARD_SIZE, [&] {
+            auto card = std::make_unique<MemoryCard>(*data);
+            sink = card->bytes()[0];
+        });
+        MemoryCard card;
+        runner.run("MemoryCard/move", MemoryCard::CARD_SIZE, [&] {
+            MemoryCard other = std::move(card);
+            card = std::move(other);
+            sink = card.powered_on();
+        });
+        runner.run("MemoryCard/clone", MemoryCard::CARD_SIZE, [&] {
+            MemoryCard other = card.clone();
+            sink = other.powered_on();
+        });
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string_view filter;
+    double min_time = 0.5;
+    std::optional<std::string_view> output_path;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--filter=")) {
+            filter = arg.substr(9);
+        } else if (arg.starts_with("--min-time=")) {
+            min_time = std::atof(argv[i] + 11);
+        } else if (arg.starts_with("--output=")) {
+            output_path = arg.substr(9);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--filter=<text>] [--min-time=<seconds>] [--output=<file>]" << std::endl;
+            return -1;
+        }
+    }
+    Runner runner(filter, min_time);
+    benchmark_send(runner);
+    benchmark_transfer(runner);
+    benchmark_slot(runner, false);
+    benchmark_slot(runner, true);
+    benchmark_trace(runner);
+    benchmark_cache(runner);
+    benchmark_replay(runner);
+    benchmark_directory(runner);
+    benchmark_image(runner);
+    benchmark_decoder(runner);
+    benchmark_construction(runner);
+    benchmark_snapshot(runner);
+    // compared against std::optional<Byte>, which TriState used to be
+    benchmark_tristate_buffers<TriState>(runner, "TriState/");
+    benchmark_tristate_buffers<std::optional<Byte>>(runner, "std::optional<Byte>/");
+    if (output_path) {
+        std::ofstream output{std::string(*output_path)};
+        runner.write_json(output);
+        return output ? 0 : -1;
+    } else {
+        runner.write_json(std::cout);
+    }
+}
@@ -0,0 +1,401 @@
+/*
+ * This is the entry point of wondercard-convert, which converts a directory
+ * tree of card images into another image format, checking that each one is
+ * a valid card image along the way. Files are converted in parallel, by a pool
+ * of worker threads which steal work from each other when they run out.
+ *
+ * Usage: wondercard-convert [--format=raw|gme|vmp] [--threads=<count>] [--check] <input directory> [<output directory>]
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+#include <wondercard/CardDirectory.hpp>
+#include <wondercard/CardImage.hpp>
+#include <wondercard/MemoryCard.hpp>
+
+
+using namespace com::saxbophone::wondercard;
+
+namespace {
+    /*
+     * Runs jobs on a number of worker threads. Each worker has a queue of its
+     * own, which jobs are handed out to in turn, and takes jobs from the front
+     * of it. A worker whose queue is empty steals from the back of the others'
+     * instead, so that one slow file doesn't hold up the jobs queued behind it.
+     * No more than a fixed number of jobs are queued at once: push() waits for
+     * there to be room, so memory use doesn't grow with the number of files.
+     */
+    template <typename Job>
+    class WorkStealingPool {
+    public:
+        // run is called with the index of the worker and the job to do
+        WorkStealingPool(std::size_t thread_count, std::size_t capacity, std::function<void(std::size_t, Job&)> run)
+          : _run(std::move(run))
+          , _capacity(capacity)
+          , _queued(0)
+          , _next(0)
+          , _done(false)
+          {
+            for (std::size_t i = 0; i < thread_count; i++) {
+                this->_queues.push_back(std::make_unique<Queue>());
+            }
+            for (std::size_t i = 0; i < thread_count; i++) {
+                this->_threads.emplace_back(&WorkStealingPool::work, this, i);
+            }
+        }
+
+        WorkStealingPool(const WorkStealingPool&) = delete;
+        WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+        ~WorkStealingPool() {
+            this->finish();
+        }
+
+        void push(Job job) {
+            {
+                std::unique_lock<std::mutex> lock(this->_mutex);
+                this->_space.wait(lock, [this] { return this->_queued < this->_capacity; });
+                this->_queued++;
+            }
+            Queue& queue = *this->_queues[this->_next++ % this->_queues.size()];
+            {
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.jobs.push_back(std::move(job));
+            }
+            this->_work.notify_one();
+        }
+
+        // waits for all the jobs pushed to be done, then stops the workers
+        void finish() {
+            {
+                std::lock_guard<std::mutex> lock(this->_mutex);
+                this->_done = true;
+            }
+            this->_work.notify_all();
+            for (std::thread& thread : this->_threads) {
+                if (thread.joinable()) {
+                    thread.join();
+                }
+            }
+        }
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Job> jobs;
+        };
+
+        // takes a job from the worker's own queue, or failing that, someone else's
+        std::optional<Job> take(std::size_t worker) {
+            std::size_t count = this->_queues.size();
+            for (std::size_t i = 0; i < count; i++) {
+                Queue& queue = *this->_queues[(worker + i) % count];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (not queue.jobs.empty()) {
+                    std::optional<Job> job;
+                    if (i == 0) {
+                        job = std::move(queue.jobs.front());
+                        queue.jobs.pop_front();
+                    } else {
+                        job = std::move(queue.jobs.back());
+                        queue.jobs.pop_back();
+                    }
+                    return job;
+                }
+            }
+            return std::nullopt;
+        }
+
+        void work(std::size_t worker) {
+            while (true) {
+                std::optional<Job> job = this->take(worker);
+                if (job) {
+                    {
+                        std::lock_guard<std::mutex> lock(this->_mutex);
+                        this->_queued--;
+                    }
+                    this->_space.notify_one();
+                    this->_run(worker, *job);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(this->_mutex);
+                // a job counted as queued may not have reached its queue yet, so look again
+                this->_work.wait(lock, [this] { return this->_queued > 0 or this->_done; });
+                if (this->_queued == 0) {
+                    return;
+                }
+            }
+        }
+
+        std::function<void(std::size_t, Job&)> _run;
+        std::vector<std::unique_ptr<Queue>> _queues;
+        std::vector<std::thread> _threads;
+        std::mutex _mutex; // guards the following
+        std::condition_variable _work;
+        std::condition_variable _space;
+        std::size_t _capacity;
+        std::size_t _queued; // pushed and not yet taken by a worker
+        std::size_t _next; // only used by the thread which pushes jobs
+        bool _done;
+    };
+
+    std::optional<CardImage::Format> parse_format(std::string_view name) {
+        if (name == "raw") {
+            return CardImage::Format::RAW;
+        } else if (name == "gme") {
+            return CardImage::Format::GME;
+        } else if (name == "vmp") {
+            return CardImage::Format::VMP;
+        }
+        return std::nullopt;
+    }
+
+    std::string_view extension_of(CardImage::Format format) {
+        switch (format) {
+        case CardImage::Format::GME:
+            return ".gme";
+        case CardImage::Format::VMP:
+            return ".vmp";
+        default:
+            return ".mcr";
+        }
+    }
+
+    struct Options {
+        std::filesystem::path input;
+        std::optional<std::filesystem::path> output; // not given when only checking
+        CardImage::Format format = CardImage::Format::RAW;
+        std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    };
+
+    class Converter {
+    public:
+        explicit Converter(const Options& options)
+          : _options(options)
+          , _cards(options.threads)
+          , _files(0)
+          , _failed(0)
+          , _bytes_read(0)
+          , _bytes_written(0)
+          {}
+
+        // converts one file, reporting why if it couldn't be
+        void convert(std::size_t worker, const std::filesystem::path& path) {
+            std::string error = this->try_convert(this->_cards[worker], path);
+            if (error.empty()) {
+                this->_files++;
+            } else {
+                this->fail(path, error);
+            }
+        }
+
+        // counts a file which isn't converted at all, reporting why
+        void fail(const std::filesystem::path& path, const std::string& error) {
+            this->_files++;
+            this->_failed++;
+            std::lock_guard<std::mutex> lock(this->_report_mutex);
+            std::cerr << path.string() << ": " << error << std::endl;
+        }
+
+        // where the converted image of the file at path is written
+        std::filesystem::path destination(const std::filesystem::path& path) const {
+            // the path was found under the input directory, so there's no need to ask the filesystem
+            std::filesystem::path destination = *this->_options.output / path.lexically_relative(this->_options.input);
+            return destination.replace_extension(extension_of(this->_options.format));
+        }
+
+        std::uint64_t files() const { return this->_files; }
+        std::uint64_t failed() const { return this->_failed; }
+        std::uint64_t bytes_read() const { return this->_bytes_read; }
+        std::uint64_t bytes_written() const { return this->_bytes_written; }
+
+    private:
+        // returns an empty string on success
+        std::string try_convert(MemoryCard& card, const std::filesystem::path& path) {
+            std::ifstream input(path, std::ios::binary);
+            if (not input) {
+                return "can't open file";
+            }
+            CardImage::Format format = CardImage::from_extension(path);
+            if (not CardImage::read(input, card, format)) {
+                return "not a valid card image";
+            }
+            if (input.peek() != std::ifstream::traits_type::eof()) {
+                return "has extra data after the card data";
+            }
+            this->_bytes_read += CardImage::header_size(format) + MemoryCard::CARD_SIZE;
+            std::span<const Byte, MemoryCard::CARD_SIZE> data = std::as_const(card).bytes();
+            if (data[0] != 'M' or data[1] != 'C') {
+                return "card is not formatted";
+            }
+            // the card header and directory frames all have checksums, which make them XOR to zero
+            for (std::size_t frame = 0; frame <= CardDirectory::FRAME_COUNT; frame++) {
+                if (MemoryCard::sector_parity(data.subspan(frame * MemoryCard::SECTOR_SIZE).first<MemoryCard::SECTOR_SIZE>()) != 0x00) {
+                    return "directory frame " + std::to_string(frame) + " has a bad checksum";
+                }
+            }
+            if (not this->_options.output) {
+                return "";
+            }
+            std::filesystem::path destination = this->destination(path);
+            std::error_code ignored; // another worker may be creating the same directories
+            std::filesystem::create_directories(destination.parent_path(), ignored);
+            std::ofstream output(destination, std::ios::binary);
+            if (not output or not CardImage::write(output, card, this->_options.format) or not output.flush()) {
+                return "can't write " + destination.string();
+            }
+            this->_bytes_written += CardImage::header_size(this->_options.format) + MemoryCard::CARD_SIZE;
+            return "";
+        }
+
+        const Options& _options;
+        std::vector<MemoryCard> _cards; // one for each worker, reused for every file it converts
+        std::atomic<std::uint64_t> _files;
+        std::atomic<std::uint64_t> _failed;
+        std::atomic<std::uint64_t> _bytes_read;
+        std::atomic<std::uint64_t> _bytes_written;
+        std::mutex _report_mutex;
+    };
+
+    /*
+     * Queues every card image under the input directory, depth-first. Only
+     * the directories on the way down to the one being read are kept open,
+     * so memory use doesn't grow with the size of the tree. Entries which
+     * can't be read are reported and skipped, and the walk carries on.
+     * Images in the same directory which only differ by extension (e.g.
+     * foo.mcr and foo.gme) would be converted to the same file, so only the
+     * first one found is converted and the others are reported.
+     */
+    void queue_images(
+        const Options& options,
+        std::filesystem::directory_iterator top,
+        Converter& converter,
+        WorkStealingPool<std::filesystem::path>& pool
+    ) {
+        struct Directory {
+            std::filesystem::path path;
+            std::filesystem::directory_iterator entries;
+            std::map<std::filesystem::path, std::filesystem::path> sources; // of the destinations of its images
+        };
+        std::vector<Directory> directories;
+        directories.push_back({options.input, std::move(top), {}});
+        while (not directories.empty()) {
+            Directory& directory = directories.back();
+            if (directory.entries == std::filesystem::directory_iterator()) {
+                directories.pop_back();
+                continue;
+            }
+            const std::filesystem::directory_entry& entry = *directory.entries;
+            std::filesystem::path path = entry.path();
+            std::error_code error;
+            // symlinks to directories aren't followed, so the walk can't go round in circles
+            bool subdirectory = std::filesystem::is_directory(entry.symlink_status(error));
+            if (not error and not subdirectory and entry.is_regular_file(error) and CardImage::from_extension(path) != CardImage::Format::UNKNOWN) {
+                // when only checking nothing is written, so nothing can clash
+                auto [source, added] = options.output
+                    ? directory.sources.try_emplace(converter.destination(path), path)
+                    : std::pair(directory.sources.end(), true);
+                if (added) {
+                    pool.push(path);
+                } else {
+                    converter.fail(path, "would be converted to the same file as " + source->second.string());
+                }
+            }
+            if (error) {
+                converter.fail(path, error.message());
+            }
+            std::error_code next_error;
+            directory.entries.increment(next_error);
+            if (next_error) {
+                converter.fail(directory.path, next_error.message());
+                directory.entries = std::filesystem::directory_iterator();
+            }
+            // only now, as adding to directories may move the one just read
+            if (subdirectory) {
+                std::filesystem::directory_iterator entries(path, error);
+                if (error) {
+                    converter.fail(path, error.message());
+                } else {
+                    directories.push_back({path, std::move(entries), {}});
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    std::vector<std::string_view> paths;
+    bool check = false;
+    bool usage = false;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--format=")) {
+            std::optional<CardImage::Format> format = parse_format(arg.substr(9));
+            usage |= not format;
+            options.format = format.value_or(CardImage::Format::RAW);
+        } else if (arg.starts_with("--threads=")) {
+            options.threads = (std::size_t)std::atol(argv[i] + 10);
+            usage |= options.threads == 0;
+        } else if (arg == "--check") {
+            check = true;
+        } else if (arg.starts_with("--")) {
+            usage = true;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (usage or paths.size() != (check ? 1u : 2u)) {
+        std::cerr << "Usage: " << argv[0] << " [--format=raw|gme|vmp] [--threads=<count>] [--check] <input directory> [<output directory>]" << std::endl;
+        std::cerr << "With --check, images are only checked, and no output directory is given." << std::endl;
+        return 2;
+    }
+    options.input = paths[0];
+    if (not check) {
+        options.output = paths[1];
+    }
+    std::error_code error;
+    std::filesystem::directory_iterator top(options.input, error);
+    if (error) {
+        std::cerr << options.input.string() << ": " << error.message() << std::endl;
+        return 2;
+    }
+    Converter converter(options);
+    auto start = std::chrono::steady_clock::now();
+    {
+        // each job is just a path, so a few per worker is plenty to keep them all busy
+        WorkStealingPool<std::filesystem::path> pool(options.threads, options.threads * 16, [&](std::size_t worker, std::filesystem::path& path) {
+            converter.convert(worker, path);
+        });
+        queue_images(options, std::move(top), converter, pool);
+        pool.finish();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double megabytes = (double)(converter.bytes_read() + converter.bytes_written()) / 1e6;
+    std::cout << (check ? "Checked " : "Converted ") << converter.files() - converter.failed() << " of " << converter.files() << " files";
+    std::cout << " in " << seconds << " s: " << (double)converter.files() / seconds << " files/s, " << megabytes / seconds << " MB/s" << std::endl;
+    return converter.failed() == 0 ? 0 : 1;
+}
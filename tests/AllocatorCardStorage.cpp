@@ -0,0 +1,78 @@
+#include <array>
+#include <memory>
+#include <utility>
+
+#include <cstddef>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/AllocatorCardStorage.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
+
+#include "test_helpers.hpp"
+
+
+using namespace com::saxbophone::wondercard;
+using namespace com::saxbophone::wondercard::PRIVATE::test_helpers;
+
+namespace {
+    // allocator which keeps count of how many bytes it has handed out
+    template <typename T>
+    struct CountingAllocator {
+        typedef T value_type;
+
+        std::size_t* allocated;
+
+        explicit CountingAllocator(std::size_t* counter) : allocated(counter) {}
+
+        template <typename U>
+        CountingAllocator(const CountingAllocator<U>& other) : allocated(other.allocated) {}
+
+        T* allocate(std::size_t n) {
+            *this->allocated += n * sizeof(T);
+            return std::allocator<T>().allocate(n);
+        }
+
+        void deallocate(T* p, std::size_t n) {
+            *this->allocated -= n * sizeof(T);
+            std::allocator<T>().deallocate(p, n);
+        }
+
+        template <typename U>
+        bool operator==(const CountingAllocator<U>& other) const {
+            return this->allocated == other.allocated;
+        }
+    };
+}
+
+SCENARIO("MemoryCards can keep their data in memory from a custom allocator") {
+    GIVEN("A MemoryCard using a counting allocator for its storage") {
+        std::size_t allocated = 0;
+        {
+            typedef AllocatorCardStorage<CountingAllocator<Byte>> Storage;
+            MemoryCard card = MemoryCard::with_storage<Storage>(CountingAllocator<Byte>(&allocated));
+            THEN("The card data has been allocated from the allocator") {
+                CHECK(allocated == MemoryCard::CARD_SIZE);
+            }
+            THEN("The card data is all zeroes") {
+                for (Byte byte : std::as_const(card).bytes()) {
+                    REQUIRE(byte == 0x00);
+                }
+            }
+            THEN("Data written through the protocol can be read back") {
+                auto sector = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+                std::array<Byte, MemoryCard::SECTOR_SIZE> read_back = {};
+                MemoryCardSlot slot;
+                REQUIRE(slot.insert_card(card));
+                REQUIRE(slot.write_sector(0x115, sector));
+                REQUIRE(slot.read_sector(0x115, read_back));
+                CHECK(read_back == sector);
+            }
+        }
+        THEN("The card data is given back to the allocator when the card is destroyed") {
+            CHECK(allocated == 0);
+        }
+    }
+}
@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/CardDirectory.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
+
+
+using namespace com::saxbophone::wondercard;
+
+namespace {
+    // builds a directory frame
+    std::array<Byte, MemoryCard::SECTOR_SIZE> frame(std::uint32_t state, std::uint32_t size, std::uint16_t next, std::string_view name) {
+        std::array<Byte, MemoryCard::SECTOR_SIZE> data = {};
+        for (std::size_t i = 0; i < 4; i++) {
+            data[i] = (Byte)(state >> (8 * i));
+            data[4 + i] = (Byte)(size >> (8 * i));
+        }
+        data[8] = (Byte)next;
+        data[9] = (Byte)(next >> 8);
+        std::copy(name.begin(), name.end(), data.begin() + 0x0A);
+        Byte checksum = 0x00;
+        for (std::size_t i = 0; i < MemoryCard::SECTOR_SIZE - 1; i++) {
+            checksum ^= data[i];
+        }
+        data[MemoryCard::SECTOR_SIZE - 1] = checksum;
+        return data;
+    }
+
+    void set_frame(MemoryCard& card, std::size_t block, const std::array<Byte, MemoryCard::SECTOR_SIZE>& data) {
+        std::copy(data.begin(), data.end(), card.get_sector(block).begin());
+    }
+
+    std::vector<std::uint8_t> blocks_of(const CardDirectory::Save* save) {
+        REQUIRE(save != nullptr);
+        return std::vector<std::uint8_t>(save->blocks.begin(), save->blocks.end());
+    }
+}
+
+SCENARIO("CardDirectory indexes the saves on a MemoryCard") {
+    GIVEN("A MemoryCard with a three-Block save in Blocks 1, 3 and 2, and a one-Block save in Block 5") {
+        MemoryCard card;
+        for (std::size_t block = 1; block <= CardDirectory::FRAME_COUNT; block++) {
+            set_frame(card, block, frame(0xA0, 0, 0xFFFF, ""));
+        }
+        set_frame(card, 1, frame(0x51, 3 * 8192, 2, "BASLUS-00001GAMEDATA"));
+        set_frame(card, 3, frame(0x52, 0, 1, ""));
+        set_frame(card, 2, frame(0x53, 0, 0xFFFF, ""));
+        set_frame(card, 5, frame(0x51, 8192, 0xFFFF, "BESCES-00002SAVE"));
+        WHEN("A CardDirectory is created for it") {
+            CardDirectory directory(card);
+            THEN("Both saves are found, with their Blocks in order") {
+                REQUIRE(directory.saves().size() == 2);
+                const CardDirectory::Save* game = directory.find("BASLUS-00001GAMEDATA");
+                CHECK(blocks_of(game) == std::vector<std::uint8_t>{1, 3, 2});
+                CHECK(game->size == 3 * 8192);
+                CHECK(game->product_code() == "SLUS-00001");
+                CHECK(blocks_of(directory.find("BESCES-00002SAVE")) == std::vector<std::uint8_t>{5});
+                CHECK(directory.find("BASLUS-99999NOTHERE") == nullptr);
+            }
+            THEN("The state of each Block is known") {
+                CHECK(directory.block_state(1) == CardDirectory::BlockState::FIRST);
+                CHECK(directory.block_state(3) == CardDirectory::BlockState::MIDDLE);
+                CHECK(directory.block_state(2) == CardDirectory::BlockState::LAST);
+                CHECK(directory.block_state(4) == CardDirectory::BlockState::FREE);
+            }
+            AND_WHEN("A new save's directory frame is written through a MemoryCardSlot") {
+                MemoryCardSlot slot;
+                REQUIRE(slot.insert_card(card));
+                auto data = frame(0x51, 8192, 0xFFFF, "BISLPS-00003NEWSAVE");
+                REQUIRE(slot.write_sector(7, data));
+                THEN("The new save is found without refreshing the directory") {
+                    REQUIRE(directory.saves().size() == 3);
+                    CHECK(blocks_of(directory.find("BISLPS-00003NEWSAVE")) == std::vector<std::uint8_t>{7});
+                }
+            }
+            AND_WHEN("A save is deleted in direct-access mode") {
+                MemoryCardSlot slot;
+                slot.set_direct_mode(true);
+                REQUIRE(slot.insert_card(card));
+                auto data = frame(0xA1, 8192, 0xFFFF, "BESCES-00002SAVE");
+                REQUIRE(slot.write_sector(5, data));
+                THEN("It is no longer found") {
+                    CHECK(directory.saves().size() == 1);
+                    CHECK(directory.find("BESCES-00002SAVE") == nullptr);
+                    CHECK(directory.block_state(5) == CardDirectory::BlockState::DELETED_FIRST);
+                }
+            }
+        }
+    }
+    GIVEN("A MemoryCard whose directory has a chain of Blocks that loops back on itself") {
+        MemoryCard card;
+        set_frame(card, 1, frame(0x51, 8192, 1, "BASLUS-00001LOOP"));
+        set_frame(card, 2, frame(0x52, 0, 0, ""));
+        WHEN("A CardDirectory is created for it") {
+            CardDirectory directory(card);
+            THEN("The save's chain stops before any Block is repeated") {
+                CHECK(blocks_of(directory.find("BASLUS-00001LOOP")) == std::vector<std::uint8_t>{1, 2});
+            }
+        }
+    }
+}
+
+SCENARIO("CardDirectory exports and imports whole saves") {
+    GIVEN("A MemoryCard with a two-Block save in Blocks 4 and 2, and every other Block free") {
+        MemoryCard card;
+        for (std::size_t block = 1; block <= CardDirectory::FRAME_COUNT; block++) {
+            set_frame(card, block, frame(0xA0, 0, 0xFFFF, ""));
+        }
+        set_frame(card, 4, frame(0x51, 2 * 8192, 1, "BASLUS-00001GAMEDATA"));
+        set_frame(card, 2, frame(0x53, 0, 0xFFFF, ""));
+        std::fill_n(card.get_block(4).begin(), MemoryCard::BLOCK_SIZE, (Byte)0x44);
+        std::fill_n(card.get_block(2).begin(), MemoryCard::BLOCK_SIZE, (Byte)0x22);
+        CardDirectory directory(card);
+        WHEN("The save is exported") {
+            CardDirectory::SaveView view = directory.export_save(*directory.find("BASLUS-00001GAMEDATA"));
+            THEN("The view is of the save's Blocks on the card, in order") {
+                REQUIRE(view.block_count() == 2);
+                CHECK(view.size() == 2 * MemoryCard::BLOCK_SIZE);
+                CHECK(view.block(0).data() == card.bytes().data() + 4 * MemoryCard::BLOCK_SIZE);
+                CHECK(view.block(1).data() == card.bytes().data() + 2 * MemoryCard::BLOCK_SIZE);
+            }
+            AND_WHEN("It is copied out") {
+                std::vector<Byte> data(view.size());
+                view.copy_to(data);
+                THEN("The data is that of both Blocks, one after the other") {
+                    CHECK(std::all_of(data.begin(), data.begin() + 8192, [](Byte b) { return b == 0x44; }));
+                    CHECK(std::all_of(data.begin() + 8192, data.end(), [](Byte b) { return b == 0x22; }));
+                }
+            }
+            AND_WHEN("It is imported again under a different name") {
+                std::vector<Byte> data(view.size());
+                view.copy_to(data);
+                card.collect_dirty_sectors();
+                const CardDirectory::Save* copy = directory.import_save("BASLUS-00001COPY", data);
+                THEN("It is stored in the lowest free Blocks, with its directory frames") {
+                    CHECK(blocks_of(copy) == std::vector<std::uint8_t>{1, 3});
+                    CHECK(copy->size == 2 * 8192);
+                    CHECK(directory.block_state(1) == CardDirectory::BlockState::FIRST);
+                    CHECK(directory.block_state(3) == CardDirectory::BlockState::LAST);
+                    auto expected = frame(0x51, 2 * 8192, 2, "BASLUS-00001COPY");
+                    auto written = card.get_sector(1);
+                    CHECK(std::equal(expected.begin(), expected.end(), written.begin()));
+                    CHECK(directory.saves().size() == 2);
+                }
+                THEN("Its data matches the original") {
+                    auto copied = directory.export_save(*directory.find("BASLUS-00001COPY"));
+                    std::vector<Byte> round_trip(copied.size());
+                    copied.copy_to(round_trip);
+                    CHECK(round_trip == data);
+                }
+                THEN("Its Blocks and directory frames are marked as dirty") {
+                    CHECK(card.dirty_sectors().count() == 2 * MemoryCard::BLOCK_SECTOR_COUNT + 2);
+                    CHECK(card.dirty_sectors().test(1 * MemoryCard::BLOCK_SECTOR_COUNT));
+                    CHECK(card.dirty_sectors().test(3));
+                }
+            }
+        }
+        WHEN("A Sector of a free Block is cached by a MemoryCardSlot, then a save is imported over it") {
+            MemoryCardSlot slot;
+            slot.set_cache_capacity(16);
+            REQUIRE(slot.insert_card(card));
+            std::array<Byte, MemoryCard::SECTOR_SIZE> sector;
+            REQUIRE(slot.read_sector(1 * MemoryCard::BLOCK_SECTOR_COUNT, sector));
+            std::vector<Byte> data(MemoryCard::BLOCK_SIZE, 0x77);
+            REQUIRE(directory.import_save("BASLUS-00002NEW", data) != nullptr);
+            THEN("Reading the Sector through the slot gives the imported data") {
+                REQUIRE(slot.read_sector(1 * MemoryCard::BLOCK_SECTOR_COUNT, sector));
+                CHECK(sector[0] == 0x77);
+                CHECK(slot.cache_stats().hits == 0);
+            }
+        }
+        WHEN("A save with the same name as an existing one is imported") {
+            std::vector<Byte> data(MemoryCard::BLOCK_SIZE);
+            THEN("Nothing is imported") {
+                CHECK(directory.import_save("BASLUS-00001GAMEDATA", data) == nullptr);
+                CHECK(directory.saves().size() == 1);
+            }
+        }
+        WHEN("A save bigger than the free space is imported") {
+            std::vector<Byte> data(14 * MemoryCard::BLOCK_SIZE);
+            THEN("Nothing is imported") {
+                CHECK(directory.import_save("BASLUS-00002BIG", data) == nullptr);
+                CHECK(directory.block_state(1) == CardDirectory::BlockState::FREE);
+            }
+        }
+        WHEN("A save that isn't a whole number of Blocks is imported") {
+            std::vector<Byte> data(MemoryCard::BLOCK_SIZE + 1);
+            THEN("An exception is thrown") {
+                CHECK_THROWS_AS(directory.import_save("BASLUS-00002ODD", data), std::invalid_argument);
+            }
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <array>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include <cstddef>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/CardImage.hpp>
+#include <wondercard/MemoryCard.hpp>
+
+#include "test_helpers.hpp"
+
+
+using namespace com::saxbophone::wondercard;
+using namespace com::saxbophone::wondercard::PRIVATE::test_helpers;
+
+SCENARIO("Card images can be written and read back in every format") {
+    auto format = GENERATE(CardImage::Format::RAW, CardImage::Format::GME, CardImage::Format::VMP);
+    GIVEN("A MemoryCard with random data, formatted with the card header") {
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        data[0] = 'M';
+        data[1] = 'C';
+        MemoryCard card(data);
+        WHEN("It is written as an image") {
+            std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+            REQUIRE(CardImage::write(stream, card, format));
+            THEN("The image is the header followed by the card data") {
+                std::string image = stream.str();
+                REQUIRE(image.size() == CardImage::header_size(format) + MemoryCard::CARD_SIZE);
+                CHECK(std::equal(data.begin(), data.end(), (const Byte*)image.data() + CardImage::header_size(format)));
+            }
+            THEN("Its format is recognised from the start of it") {
+                std::string image = stream.str();
+                CHECK(CardImage::sniff(std::span<const Byte>((const Byte*)image.data(), CardImage::SNIFF_SIZE)) == format);
+            }
+            AND_WHEN("It is read back into another card, without saying which format it is") {
+                MemoryCard other;
+                other.collect_dirty_sectors();
+                REQUIRE(CardImage::read(stream, other));
+                THEN("The other card has the same data, all of it marked as dirty") {
+                    CHECK(std::equal(data.begin(), data.end(), other.bytes().begin()));
+                    CHECK(other.dirty_sectors().count() == MemoryCard::CARD_SECTOR_COUNT);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Card images which can't be read are rejected") {
+    GIVEN("A RAW image of an unformatted card") {
+        std::array<Byte, MemoryCard::CARD_SIZE> data = {};
+        std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+        REQUIRE(CardImage::write(stream, data, CardImage::Format::RAW));
+        MemoryCard card;
+        THEN("It can't be read without saying it's RAW") {
+            CHECK_FALSE(CardImage::read(stream, card));
+        }
+        THEN("It can be read when it is said to be RAW") {
+            CHECK(CardImage::read(stream, card, CardImage::Format::RAW));
+        }
+        THEN("It can't be read as a GME image") {
+            CHECK_FALSE(CardImage::read(stream, card, CardImage::Format::GME));
+        }
+    }
+    GIVEN("A GME image which ends part-way through the card data") {
+        std::array<Byte, MemoryCard::CARD_SIZE> data = {};
+        std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+        REQUIRE(CardImage::write(stream, data, CardImage::Format::GME));
+        std::string image = stream.str();
+        stream.str(image.substr(0, image.size() - 1));
+        THEN("It can't be read") {
+            MemoryCard card;
+            CHECK_FALSE(CardImage::read(stream, card));
+        }
+    }
+    THEN("An image can't be written in an unknown format") {
+        MemoryCard card;
+        std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+        CHECK_THROWS_AS(CardImage::write(stream, card, CardImage::Format::UNKNOWN), std::invalid_argument);
+    }
+}
+
+SCENARIO("The format of a card image is guessed from its file extension") {
+    CHECK(CardImage::from_extension("saves/card.mcr") == CardImage::Format::RAW);
+    CHECK(CardImage::from_extension("card.MCD") == CardImage::Format::RAW);
+    CHECK(CardImage::from_extension("card.gme") == CardImage::Format::GME);
+    CHECK(CardImage::from_extension("SCUS94163.VMP") == CardImage::Format::VMP);
+    CHECK(CardImage::from_extension("notes.txt") == CardImage::Format::UNKNOWN);
+    CHECK(CardImage::from_extension("card") == CardImage::Format::UNKNOWN);
+}
@@ -0,0 +1,94 @@
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+
+#include <cstdint>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MappedCardStorage.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
+
+#include "test_helpers.hpp"
+
+
+using namespace com::saxbophone::wondercard;
+using namespace com::saxbophone::wondercard::PRIVATE::test_helpers;
+
+namespace {
+    // writes the given data to a new file at the given path
+    template <std::size_t SIZE>
+    void write_file(const std::filesystem::path& path, const std::array<Byte, SIZE>& data) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write((const char*)data.data(), (std::streamsize)data.size());
+    }
+
+    // reads the entire contents of the card image file at the given path
+    std::array<Byte, MemoryCard::CARD_SIZE> read_file(const std::filesystem::path& path) {
+        std::array<Byte, MemoryCard::CARD_SIZE> data = {};
+        std::ifstream file(path, std::ios::binary);
+        file.read((char*)data.data(), (std::streamsize)data.size());
+        return data;
+    }
+}
+
+SCENARIO("MemoryCards can be backed by a memory-mapped card image file") {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "wondercard_test_mapped.mcr";
+    std::filesystem::remove(path);
+    GIVEN("A card image file containing random data") {
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        write_file(path, data);
+        WHEN("A MemoryCard is constructed with the file mapped as its storage") {
+            MemoryCard card(std::make_unique<MappedCardStorage>(path));
+            THEN("The MemoryCard bytes are identical to the file contents") {
+                for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                    REQUIRE(card.bytes()[i] == data[i]);
+                }
+            }
+            AND_WHEN("A sector is written to the card through the protocol and the card is synced") {
+                auto sector = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+                std::size_t sector_number = GENERATE(0x000u, 0x115u, 0x3FFu);
+                MemoryCardSlot slot;
+                REQUIRE(slot.insert_card(card));
+                REQUIRE(slot.write_sector(sector_number, sector));
+                REQUIRE(card.sync());
+                THEN("The sector has been written to the file and the rest of the file is unchanged") {
+                    auto file_data = read_file(path);
+                    for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                        std::size_t offset = i - sector_number * MemoryCard::SECTOR_SIZE;
+                        if (i / MemoryCard::SECTOR_SIZE == sector_number) {
+                            REQUIRE(file_data[i] == sector[offset]);
+                        } else {
+                            REQUIRE(file_data[i] == data[i]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    GIVEN("No card image file") {
+        THEN("Mapping the file fails") {
+            CHECK_THROWS_AS(MappedCardStorage(path), std::system_error);
+        }
+        THEN("Mapping the file with creation enabled creates an all-zero card image") {
+            MemoryCard card(std::make_unique<MappedCardStorage>(path, true));
+            REQUIRE(std::filesystem::file_size(path) == MemoryCard::CARD_SIZE);
+            for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                REQUIRE(card.bytes()[i] == 0x00);
+            }
+        }
+    }
+    GIVEN("A file which is not the size of a card image") {
+        write_file(path, generate_random_bytes<1000u>());
+        THEN("Mapping the file fails") {
+            CHECK_THROWS_AS(MappedCardStorage(path), std::invalid_argument);
+            CHECK_THROWS_AS(MappedCardStorage(path, true), std::invalid_argument);
+        }
+    }
+    std::filesystem::remove(path);
+}
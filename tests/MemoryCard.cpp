@@ -1,5 +1,11 @@
+#include <algorithm>
+#include <array>
+#include <memory>
 #include <optional>
 #include <random>
+#include <span>
+#include <utility>
+#include <vector>
 
 #include <cstdint>
 
@@ -7,6 +13,7 @@
 
 #include <wondercard/common.hpp>
 #include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
 
 #include "test_helpers.hpp"
 
@@ -17,15 +24,15 @@ using namespace com::saxbophone::wondercard::PRIVATE::test_helpers;
 SCENARIO("MemoryCard can be powered on when off and off when on") {
     GIVEN("A MemoryCard that is powered off") {
         MemoryCard card;
-        REQUIRE_FALSE(card.powered_on);
+        REQUIRE_FALSE(card.powered_on());
         THEN("The MemoryCard can be powered on successfully") {
             REQUIRE(card.power_on());
             AND_WHEN("The MemoryCard is powered on") {
-                REQUIRE(card.powered_on);
+                REQUIRE(card.powered_on());
                 THEN("The MemoryCard can be powered off successfully") {
                     REQUIRE(card.power_off());
                     AND_WHEN("The MemoryCard is powered off") {
-                        REQUIRE_FALSE(card.powered_on);
+                        REQUIRE_FALSE(card.powered_on());
                         THEN("The MemoryCard cannot be powered off successfully") {
                             CHECK_FALSE(card.power_off());
                         }
@@ -356,6 +363,46 @@ SCENARIO("Writing Data to Memory Card") {
     }
 }
 
+SCENARIO("MemoryCard FLAG shows whether the card has been written to since power-on") {
+    GIVEN("A MemoryCard that is inserted into a MemoryCardSlot") {
+        MemoryCard card;
+        MemoryCardSlot slot;
+        REQUIRE(slot.insert_card(card));
+        // the card replies to the command byte with FLAG
+        auto flag = [&]() {
+            TriState response;
+            REQUIRE(slot.send(0x81, response));
+            slot.send(0x00, response); // not a valid command, so ends the transaction
+            return response;
+        };
+        THEN("The FLAG starts with bit 3 set") {
+            CHECK(flag() == 0x08);
+        }
+        WHEN("A Sector is written successfully") {
+            std::array<Byte, MemoryCard::SECTOR_SIZE> sector = {};
+            REQUIRE(slot.write_sector(0x03F, sector));
+            THEN("The FLAG is cleared") {
+                CHECK(flag() == 0x00);
+            }
+            AND_WHEN("The card is powered off and on again") {
+                REQUIRE(card.power_off());
+                REQUIRE(card.power_on());
+                THEN("The FLAG is set again") {
+                    CHECK(flag() == 0x08);
+                }
+            }
+        }
+        WHEN("A Sector is written successfully in direct-access mode") {
+            slot.set_direct_mode(true);
+            std::array<Byte, MemoryCard::SECTOR_SIZE> sector = {};
+            REQUIRE(slot.write_sector(0x03F, sector));
+            THEN("The FLAG is cleared") {
+                CHECK(flag() == 0x00);
+            }
+        }
+    }
+}
+
 SCENARIO("Get Memory Card ID Command") {
     GIVEN("A MemoryCard that is powered on") {
         MemoryCard card;
@@ -399,7 +446,7 @@ SCENARIO("Populate Memory Card data") {
             MemoryCard card(data);
             THEN("The MemoryCard bytes should be identical to those of the data") {
                 for (std::size_t i = 0; i < CARD_SIZE; i++) {
-                    REQUIRE(card.bytes[i] == data[i]);
+                    REQUIRE(card.bytes()[i] == data[i]);
                 }
             }
             THEN("Data can be accessed correctly by Block") {
@@ -435,7 +482,7 @@ SCENARIO("Populate Memory Card data") {
                 std::copy(data.begin(), data.end(), card.get_block(b).begin());
                 THEN("The correct range of MemoryCard data is written to") {
                     for (std::size_t i = 0; i < BLOCK_SIZE; i++) {
-                        REQUIRE(data[i] == card.bytes[b * BLOCK_SIZE + i]);
+                        REQUIRE(data[i] == card.bytes()[b * BLOCK_SIZE + i]);
                     }
                 }
             }
@@ -451,10 +498,400 @@ SCENARIO("Populate Memory Card data") {
                 std::copy(data.begin(), data.end(), card.get_sector(s).begin());
                 THEN("The correct range of MemoryCard data is written to") {
                     for (std::size_t i = 0; i < SECTOR_SIZE; i++) {
-                        REQUIRE(data[i] == card.bytes[s * SECTOR_SIZE + i]);
+                        REQUIRE(data[i] == card.bytes()[s * SECTOR_SIZE + i]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("MemoryCard.transfer() behaves the same as calling MemoryCard.send() in a loop") {
+    GIVEN("A sequence of command bytes spanning several transactions") {
+        auto data = generate_random_bytes<128u>();
+        Byte data_checksum = 0x00;
+        for (auto byte : data) {
+            data_checksum ^= byte;
+        }
+        std::vector<TriState> inputs = {
+            0x81, 0x53, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // get ID
+            0x81, 0x57, 0x00, 0x00, 0x01, 0x23, // write header
+        };
+        inputs.insert(inputs.end(), data.begin(), data.end());
+        inputs.insert(inputs.end(), {(Byte)(0x01 ^ 0x23 ^ data_checksum), 0x00, 0x00, 0x00});
+        inputs.insert(inputs.end(), {0x81, 0x52, 0x00, 0x00, 0x01, 0x23, 0x00, 0x00, 0x00, 0x00}); // read header
+        inputs.insert(inputs.end(), 130u, 0x00); // read data, checksum and end byte
+        inputs.insert(inputs.end(), {0x01, std::nullopt, 0x81, 0x33}); // junk and invalid command
+        AND_GIVEN("Two identical MemoryCards that are powered on") {
+            auto card_data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+            MemoryCard card(card_data), control(card_data);
+            REQUIRE(card.power_on());
+            REQUIRE(control.power_on());
+            // split the sequence into frames of a given size to exercise resumption mid-sector
+            std::size_t frame_size = GENERATE(1u, 7u, 64u, 300u, 1000u);
+            WHEN("The sequence is sent to one card with send() and to the other with transfer()") {
+                std::vector<TriState> expected_outputs(inputs.size());
+                std::vector<TriState> outputs(inputs.size());
+                std::unique_ptr<bool[]> expected_acks(new bool[inputs.size()]);
+                std::unique_ptr<bool[]> acks(new bool[inputs.size()]);
+                for (std::size_t i = 0; i < inputs.size(); i++) {
+                    expected_acks[i] = control.send(inputs[i], expected_outputs[i]);
+                }
+                for (std::size_t i = 0; i < inputs.size(); i += frame_size) {
+                    std::size_t size = std::min(frame_size, inputs.size() - i);
+                    REQUIRE(
+                        card.transfer(
+                            std::span(inputs).subspan(i, size),
+                            std::span(outputs).subspan(i, size),
+                            std::span(acks.get() + i, size)
+                        ) == size
+                    );
+                }
+                THEN("The responses and ACKs are identical") {
+                    for (std::size_t i = 0; i < inputs.size(); i++) {
+                        REQUIRE(acks[i] == expected_acks[i]);
+                        REQUIRE(outputs[i] == expected_outputs[i]);
+                    }
+                    AND_THEN("The card data of both cards is identical") {
+                        for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                            REQUIRE(card.bytes()[i] == control.bytes()[i]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("MemoryCard keeps track of which Sectors have been written to") {
+    GIVEN("A MemoryCard that is powered on") {
+        MemoryCard card;
+        REQUIRE(card.power_on());
+        THEN("No Sectors are dirty") {
+            CHECK_FALSE(card.dirty_sectors().any());
+        }
+        std::uint16_t sector = GENERATE(take(10, random(0x0000, 0x03FF)));
+        Byte msb = sector >> 8;
+        Byte lsb = (Byte)(sector & 0x00FF);
+        WHEN("A Sector is written to the card") {
+            std::vector<TriState> inputs = {0x81, 0x57, 0x00, 0x00, msb, lsb};
+            inputs.insert(inputs.end(), 128u, 0x13);
+            inputs.insert(inputs.end(), {(Byte)(msb ^ lsb), 0x00, 0x00, 0x00});
+            for (TriState command : inputs) {
+                TriState response;
+                card.send(command, response);
+            }
+            THEN("Only that Sector is dirty") {
+                CHECK(card.dirty_sectors().count() == 1);
+                CHECK(card.dirty_sectors().test(sector));
+            }
+            AND_WHEN("The dirty Sectors are collected") {
+                SectorBitmap dirty = card.collect_dirty_sectors();
+                THEN("The collected Sectors are those that were dirty and the card has no dirty Sectors left") {
+                    CHECK(dirty.count() == 1);
+                    CHECK(dirty.test(sector));
+                    CHECK_FALSE(card.dirty_sectors().any());
+                }
+            }
+        }
+        WHEN("A Sector is read from the card") {
+            std::vector<TriState> inputs = {0x81, 0x52, 0x00, 0x00, msb, lsb};
+            inputs.insert(inputs.end(), 134u, 0x00);
+            for (TriState command : inputs) {
+                TriState response;
+                card.send(command, response);
+            }
+            THEN("No Sectors are dirty") {
+                CHECK_FALSE(card.dirty_sectors().any());
+            }
+        }
+        WHEN("A write to an invalid Sector is attempted") {
+            std::vector<TriState> inputs = {0x81, 0x57, 0x00, 0x00, 0x04, lsb};
+            inputs.insert(inputs.end(), 132u, 0x00);
+            for (TriState command : inputs) {
+                TriState response;
+                card.send(command, response);
+            }
+            THEN("No Sectors are dirty") {
+                CHECK_FALSE(card.dirty_sectors().any());
+            }
+        }
+        WHEN("A Sector is marked as dirty explicitly") {
+            card.mark_dirty(sector);
+            THEN("That Sector is dirty") {
+                CHECK(card.dirty_sectors().test(sector));
+            }
+        }
+    }
+}
+
+SCENARIO("MemoryCard::sector_parity() gives the XOR of all bytes of a Sector") {
+    GIVEN("Some random Sector data") {
+        auto data = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+        THEN("The parity of the data is the XOR of all of its bytes") {
+            Byte expected = 0x00;
+            for (Byte byte : data) {
+                expected ^= byte;
+            }
+            CHECK(MemoryCard::sector_parity(data) == expected);
+        }
+    }
+}
+
+SCENARIO("MemoryCard read checksums stay correct as the Sector data changes") {
+    GIVEN("A MemoryCard with random data that is powered on") {
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        MemoryCard card(data);
+        REQUIRE(card.power_on());
+        std::uint16_t sector = GENERATE(take(10, random(0x0000, 0x03FF)));
+        Byte msb = sector >> 8;
+        Byte lsb = (Byte)(sector & 0x00FF);
+        // reads the Sector with send() and returns the checksum sent by the card
+        auto read_checksum = [&]() {
+            std::vector<TriState> inputs = {0x81, 0x52, 0x00, 0x00, msb, lsb};
+            inputs.insert(inputs.end(), 134u, 0x00);
+            std::vector<TriState> outputs(inputs.size());
+            for (std::size_t i = 0; i < inputs.size(); i++) {
+                card.send(inputs[i], outputs[i]);
+            }
+            return outputs[138];
+        };
+        auto expected_checksum = [&]() {
+            return (Byte)(msb ^ lsb ^ MemoryCard::sector_parity(card.get_sector(sector)));
+        };
+        THEN("Reading the same Sector repeatedly gives the right checksum each time") {
+            Byte expected = expected_checksum();
+            CHECK(read_checksum() == expected);
+            CHECK(read_checksum() == expected);
+        }
+        WHEN("The Sector is written to with send()") {
+            CHECK(read_checksum() == expected_checksum());
+            auto sector_data = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+            std::vector<TriState> inputs = {0x81, 0x57, 0x00, 0x00, msb, lsb};
+            inputs.insert(inputs.end(), sector_data.begin(), sector_data.end());
+            inputs.insert(inputs.end(), {(Byte)(msb ^ lsb ^ MemoryCard::sector_parity(sector_data)), 0x00, 0x00, 0x00});
+            for (TriState command : inputs) {
+                TriState response;
+                card.send(command, response);
+            }
+            THEN("Reading the Sector gives the checksum of the new data") {
+                CHECK(read_checksum() == (Byte)(msb ^ lsb ^ MemoryCard::sector_parity(sector_data)));
+            }
+        }
+        WHEN("The Sector data is changed through get_sector()") {
+            CHECK(read_checksum() == expected_checksum());
+            card.get_sector(sector)[7] ^= 0x5A;
+            THEN("Reading the Sector gives the checksum of the new data") {
+                CHECK(read_checksum() == expected_checksum());
+            }
+        }
+        WHEN("The Sector data is changed through a view taken before the last read, without marking it dirty") {
+            auto view = card.bytes();
+            CHECK(read_checksum() == expected_checksum());
+            view[sector * MemoryCard::SECTOR_SIZE + 3] ^= 0x3C;
+            THEN("Reading the Sector gives the checksum of the new data") {
+                CHECK(read_checksum() == expected_checksum());
+            }
+        }
+        WHEN("The Sector data is changed through bytes and marked dirty") {
+            CHECK(read_checksum() == expected_checksum());
+            card.bytes()[sector * MemoryCard::SECTOR_SIZE + 100] ^= 0xA5;
+            card.mark_dirty(sector);
+            THEN("Reading the Sector gives the checksum of the new data") {
+                CHECK(read_checksum() == expected_checksum());
+            }
+        }
+    }
+}
+
+SCENARIO("MemoryCards can be moved cheaply and cloned explicitly") {
+    GIVEN("A MemoryCard with random data that is powered on") {
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        MemoryCard card(data);
+        REQUIRE(card.power_on());
+        const Byte* card_data = std::as_const(card).bytes().data();
+        WHEN("The MemoryCard is moved into another one") {
+            MemoryCard moved(std::move(card));
+            THEN("The other MemoryCard has taken over the card data without copying it") {
+                CHECK(std::as_const(moved).bytes().data() == card_data);
+                CHECK(moved.powered_on());
+            }
+            THEN("The original MemoryCard is left powered off") {
+                CHECK_FALSE(card.powered_on());
+            }
+        }
+        WHEN("The MemoryCard is move-assigned to another one") {
+            MemoryCard other;
+            other = std::move(card);
+            THEN("The other MemoryCard has taken over the card data without copying it") {
+                CHECK(std::as_const(other).bytes().data() == card_data);
+                CHECK(other.powered_on());
+            }
+        }
+        WHEN("The MemoryCard is moved into a vector which then grows") {
+            std::vector<MemoryCard> cards;
+            cards.push_back(std::move(card));
+            for (std::size_t i = 0; i < 16; i++) {
+                cards.emplace_back();
+            }
+            THEN("The card data has stayed where it was") {
+                CHECK(std::as_const(cards[0]).bytes().data() == card_data);
+            }
+        }
+        WHEN("The MemoryCard is cloned") {
+            MemoryCard copy = card.clone();
+            THEN("The clone has its own copy of the card data, in the same state") {
+                CHECK(std::as_const(copy).bytes().data() != card_data);
+                CHECK(copy.powered_on());
+                for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                    REQUIRE(copy.bytes()[i] == data[i]);
+                }
+            }
+            AND_WHEN("The clone's data is changed") {
+                copy.bytes()[0] ^= 0xFF;
+                THEN("The original MemoryCard's data is unchanged") {
+                    CHECK(card.bytes()[0] == data[0]);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("MemoryCard state can be saved and restored part-way through a transaction") {
+    GIVEN("Two MemoryCards with the same random data that are powered on") {
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        MemoryCard card(data), other(data);
+        REQUIRE(card.power_on());
+        REQUIRE(other.power_on());
+        AND_GIVEN("The command bytes to read a Sector, split part-way through") {
+            std::vector<TriState> inputs = {0x81, 0x52, 0x00, 0x00, 0x01, 0x15};
+            inputs.insert(inputs.end(), 134u, 0x00);
+            std::size_t split = GENERATE(0u, 1u, 5u, 9u, 50u, 138u);
+            WHEN("The first part is sent to one card, its machine state is copied to the other and the rest is sent to both") {
+                for (std::size_t i = 0; i < split; i++) {
+                    TriState response;
+                    card.send(inputs[i], response);
+                }
+                std::array<Byte, MemoryCard::MACHINE_STATE_SIZE> state;
+                REQUIRE(card.serialize(state) == MemoryCard::MACHINE_STATE_SIZE);
+                REQUIRE(other.deserialize(state));
+                THEN("Both cards respond identically to the rest of the commands") {
+                    for (std::size_t i = split; i < inputs.size(); i++) {
+                        TriState response, other_response;
+                        REQUIRE(card.send(inputs[i], response) == other.send(inputs[i], other_response));
+                        REQUIRE(response == other_response);
+                    }
+                }
+            }
+        }
+    }
+    GIVEN("A MemoryCard that is powered on, and the command bytes to read a Sector which doesn't exist, split part-way through") {
+        MemoryCard card, other;
+        REQUIRE(card.power_on());
+        REQUIRE(other.power_on());
+        std::vector<TriState> inputs = {0x81, 0x52, 0x00, 0x00, 0x04, 0x15, 0x00, 0x00, 0x00, 0x00};
+        // after the address, before confirming it, and once the card has given up on it
+        std::size_t split = GENERATE(6u, 9u, 10u);
+        WHEN("The first part is sent to the card and its machine state is copied to another") {
+            for (std::size_t i = 0; i < split; i++) {
+                TriState response;
+                card.send(inputs[i], response);
+            }
+            std::array<Byte, MemoryCard::MACHINE_STATE_SIZE> state;
+            REQUIRE(card.serialize(state) == MemoryCard::MACHINE_STATE_SIZE);
+            THEN("The other card accepts it") {
+                CHECK(other.deserialize(state));
+            }
+        }
+    }
+    GIVEN("A MemoryCard that is powered on") {
+        MemoryCard card;
+        REQUIRE(card.power_on());
+        WHEN("Machine states which the protocol can never reach are restored") {
+            // version, mode, powered on, flag, state, address MSB, address LSB, byte counter, checksum
+            auto bad = GENERATE(
+                // reading the data of a Sector which doesn't exist
+                std::array<Byte, 9>{0x01, 0x00, 0x01, 0x08, 10, 0xFF, 0xFF, 0x00, 0x00},
+                std::array<Byte, 9>{0x01, 0x00, 0x01, 0x08, 11, 0xFF, 0xFF, 0x80, 0x00},
+                std::array<Byte, 9>{0x01, 0x00, 0x01, 0x08, 12, 0xFF, 0xFF, 0x80, 0x00},
+                // a Sector beyond the end of the card
+                std::array<Byte, 9>{0x01, 0x00, 0x01, 0x08, 0, 0x04, 0x00, 0x00, 0x00},
+                std::array<Byte, 9>{0x01, 0x00, 0x01, 0x08, 17, 0xFF, 0xFE, 0x00, 0x00},
+                // past the end of the Sector while still reading or writing its data
+                std::array<Byte, 9>{0x01, 0x00, 0x01, 0x08, 10, 0x00, 0x03, 0x80, 0x00},
+                std::array<Byte, 9>{0x01, 0x00, 0x01, 0x08, 17, 0x00, 0x03, 0x80, 0x00},
+                // no such state
+                std::array<Byte, 9>{0x01, 0x00, 0x01, 0x08, 0xFF, 0x00, 0x03, 0x00, 0x00}
+            );
+            THEN("The card refuses them, and carries on as it was") {
+                CHECK_FALSE(card.deserialize(bad));
+                std::array<Byte, MemoryCard::SECTOR_SIZE> sector;
+                MemoryCardSlot slot;
+                REQUIRE(card.power_off());
+                REQUIRE(slot.insert_card(card));
+                CHECK(slot.read_sector(0x003, sector));
+            }
+        }
+    }
+    GIVEN("A MemoryCard with random data and a full snapshot of it") {
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        MemoryCard card(data);
+        std::vector<Byte> base(card.snapshot_size(MemoryCard::SnapshotMode::FULL));
+        REQUIRE(card.serialize(base, MemoryCard::SnapshotMode::FULL) == base.size());
+        AND_GIVEN("Some Sectors are then written to the card") {
+            MemoryCardSlot slot;
+            REQUIRE(slot.insert_card(card));
+            std::vector<std::size_t> sectors = {0x000, 0x115, 0x3FF};
+            for (std::size_t sector : sectors) {
+                auto sector_data = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+                REQUIRE(slot.write_sector(sector, sector_data));
+            }
+            THEN("A dirty snapshot only holds the Sectors written since the base") {
+                CHECK(
+                    card.snapshot_size(MemoryCard::SnapshotMode::DIRTY_SINCE_BASE) ==
+                    MemoryCard::MACHINE_STATE_SIZE + 128u + sectors.size() * MemoryCard::SECTOR_SIZE
+                );
+            }
+            WHEN("The full snapshot is restored") {
+                REQUIRE(card.deserialize(base));
+                THEN("The card data is as it was when the snapshot was taken") {
+                    for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                        REQUIRE(card.bytes()[i] == data[i]);
                     }
                 }
             }
+            WHEN("A dirty snapshot is restored on top of the base snapshot on another card") {
+                std::vector<Byte> delta(card.snapshot_size(MemoryCard::SnapshotMode::DIRTY_SINCE_BASE));
+                REQUIRE(card.serialize(delta, MemoryCard::SnapshotMode::DIRTY_SINCE_BASE) == delta.size());
+                MemoryCard other;
+                REQUIRE(other.deserialize(base));
+                REQUIRE(other.deserialize(delta));
+                THEN("The other card's data is identical to the card's") {
+                    for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                        REQUIRE(other.bytes()[i] == card.bytes()[i]);
+                    }
+                }
+                THEN("The next dirty snapshot holds no Sectors") {
+                    CHECK(
+                        card.snapshot_size(MemoryCard::SnapshotMode::DIRTY_SINCE_BASE) ==
+                        MemoryCard::MACHINE_STATE_SIZE + 128u
+                    );
+                }
+            }
+        }
+        WHEN("A buffer which is not a valid snapshot is restored") {
+            std::vector<Byte> bad = base;
+            bad[0] = 0xFF;
+            THEN("The card refuses it") {
+                CHECK_FALSE(card.deserialize(bad));
+                CHECK_FALSE(card.deserialize(std::span<const Byte>(base).first(base.size() - 1)));
+            }
+        }
+        WHEN("A snapshot is written to a buffer which is too small") {
+            std::array<Byte, MemoryCard::MACHINE_STATE_SIZE> state;
+            THEN("Nothing is written") {
+                CHECK(card.serialize(state, MemoryCard::SnapshotMode::FULL) == 0);
+            }
         }
     }
 }
@@ -0,0 +1,94 @@
+#include <array>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <cstddef>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardController.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
+
+#include "test_helpers.hpp"
+
+
+using namespace com::saxbophone::wondercard;
+using namespace com::saxbophone::wondercard::PRIVATE::test_helpers;
+
+SCENARIO("MemoryCardController carries out operations on many slots concurrently") {
+    GIVEN("A MemoryCardController with several slots") {
+        constexpr std::size_t SLOT_COUNT = 4;
+        MemoryCardController controller(SLOT_COUNT);
+        REQUIRE(controller.slot_count() == SLOT_COUNT);
+        THEN("Operations on a slot that doesn't exist are refused") {
+            CHECK_THROWS_AS(controller.remove_card(SLOT_COUNT), std::out_of_range);
+        }
+        THEN("Operations on empty slots fail") {
+            std::array<Byte, MemoryCard::SECTOR_SIZE> sector;
+            CHECK_FALSE(controller.read_sector(0, 0x000, sector).get());
+            CHECK_FALSE(controller.remove_card(1).get());
+        }
+        AND_GIVEN("A MemoryCard inserted into each slot, each with different data") {
+            auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+            std::vector<std::unique_ptr<MemoryCard>> cards;
+            for (std::size_t s = 0; s < SLOT_COUNT; s++) {
+                // make each card different by shifting the data around
+                std::array<Byte, MemoryCard::CARD_SIZE> card_data;
+                for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                    card_data[i] = data[(i + s) % MemoryCard::CARD_SIZE];
+                }
+                cards.push_back(std::make_unique<MemoryCard>(card_data));
+                REQUIRE(controller.insert_card(s, *cards.back()).get());
+            }
+            WHEN("Every card is read at the same time") {
+                std::vector<std::array<Byte, MemoryCard::CARD_SIZE>> outputs(SLOT_COUNT);
+                std::vector<std::future<MemoryCardSlot::Result>> results;
+                for (std::size_t s = 0; s < SLOT_COUNT; s++) {
+                    results.push_back(controller.read_card(s, outputs[s]));
+                }
+                THEN("All reads succeed and return the data of the card in the right slot") {
+                    for (std::size_t s = 0; s < SLOT_COUNT; s++) {
+                        REQUIRE(results[s].get());
+                        for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                            REQUIRE(outputs[s][i] == cards[s]->bytes()[i]);
+                        }
+                    }
+                }
+            }
+            WHEN("Different Sectors are written to and read back from every card at the same time") {
+                std::vector<std::array<Byte, MemoryCard::SECTOR_SIZE>> sectors(SLOT_COUNT), outputs(SLOT_COUNT);
+                std::vector<std::future<MemoryCardSlot::Result>> writes, reads;
+                for (std::size_t s = 0; s < SLOT_COUNT; s++) {
+                    sectors[s].fill((Byte)s);
+                    writes.push_back(controller.write_sector(s, 0x100 + s, sectors[s]));
+                    // operations on the same slot are done in order, so this reads what was just written
+                    reads.push_back(controller.read_sector(s, 0x100 + s, outputs[s]));
+                }
+                THEN("All operations succeed and each card has the data written to it") {
+                    for (std::size_t s = 0; s < SLOT_COUNT; s++) {
+                        REQUIRE(writes[s].get());
+                        REQUIRE(reads[s].get());
+                        REQUIRE(outputs[s] == sectors[s]);
+                    }
+                }
+            }
+            WHEN("A custom operation is submitted to a slot") {
+                auto result = controller.submit(2, [](MemoryCardSlot& slot) {
+                    slot.set_direct_mode(true);
+                    return slot.direct_mode();
+                });
+                THEN("It is called with that slot and its result is returned") {
+                    REQUIRE(result.get());
+                }
+            }
+            // cards must outlive the controller's use of them
+            for (std::size_t s = 0; s < SLOT_COUNT; s++) {
+                REQUIRE(controller.remove_card(s).get());
+            }
+        }
+    }
+}
@@ -1,14 +1,19 @@
+#include <algorithm>
 #include <array>
 #include <optional>
+#include <span>
 #include <vector>
 
+#include <cstddef>
 #include <cstdint>
 
 #include <catch2/catch.hpp>
 
 #include <wondercard/common.hpp>
+#include <wondercard/CardObserver.hpp>
 #include <wondercard/MemoryCard.hpp>
 #include <wondercard/MemoryCardSlot.hpp>
+#include <wondercard/SectorBitmap.hpp>
 
 #include "test_helpers.hpp"
 
@@ -16,6 +21,30 @@
 using namespace com::saxbophone::wondercard;
 using namespace com::saxbophone::wondercard::PRIVATE::test_helpers;
 
+namespace {
+    // flips a byte of the caller's data once the card has received all of it, as if it were changed mid-write
+    class DataChanger : public CardObserver {
+    public:
+        explicit DataChanger(std::span<Byte> data) : _data(data) {}
+
+        void sector_written(std::size_t, std::span<const Byte>) override {
+            this->_data[0] ^= 0xFF;
+        }
+
+    private:
+        std::span<Byte> _data;
+    };
+
+    // sends the given bytes to the card through the slot, returning its responses
+    std::vector<TriState> send_all(MemoryCardSlot& slot, const std::vector<TriState>& commands) {
+        std::vector<TriState> responses(commands.size());
+        for (std::size_t i = 0; i < commands.size(); i++) {
+            slot.send(commands[i], responses[i]);
+        }
+        return responses;
+    }
+}
+
 SCENARIO("MemoryCards can be inserted and removed from MemoryCardSlot") {
     GIVEN("An empty MemoryCardSlot") {
         MemoryCardSlot slot;
@@ -28,7 +57,7 @@ SCENARIO("MemoryCards can be inserted and removed from MemoryCardSlot") {
                 REQUIRE(slot.insert_card(card));
                 AND_WHEN("The slot has had a card inserted into it") {
                     THEN("The card should be powered on") {
-                        CHECK(card.powered_on);
+                        CHECK(card.powered_on());
                     }
                     THEN("Attempting to insert a card into the slot fails") {
                         CHECK_FALSE(slot.insert_card(card)); // doesn't matter that it's the same card
@@ -36,7 +65,7 @@ SCENARIO("MemoryCards can be inserted and removed from MemoryCardSlot") {
                     THEN("The card can be removed from the slot successfully") {
                         REQUIRE(slot.remove_card());
                         AND_THEN("The card should be powered off") {
-                            CHECK_FALSE(card.powered_on);
+                            CHECK_FALSE(card.powered_on());
                         }
                     }
                 }
@@ -112,7 +141,7 @@ SCENARIO("Using higher level I/O API to read entire MemoryCard") {
         > data = generate_random_bytes<MemoryCard::CARD_SIZE>();
         AND_GIVEN("A MemoryCard initialised with that data") {
             MemoryCard card(data);
-            auto bytes = card.bytes;
+            auto bytes = card.bytes();
             // verify card data is correct --test is invalid if not
             for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
                 REQUIRE(bytes[i] == data[i]);
@@ -149,7 +178,7 @@ SCENARIO("Using higher level I/O API to write entire MemoryCard") {
                 WHEN("MemoryCardSlot.write_card() is called with the data") {
                     REQUIRE(slot.write_card(data));
                     THEN("The card data bytes should equal those of the data") {
-                        auto bytes = card.bytes;
+                        auto bytes = card.bytes();
                         for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
                             REQUIRE(bytes[i] == data[i]);
                         }
@@ -278,3 +307,332 @@ SCENARIO("Using higher level I/O API to write a MemoryCard Sector") {
         }
     }
 }
+
+SCENARIO("MemoryCardSlot direct-access mode is equivalent to using the protocol") {
+    GIVEN("Two identical MemoryCards initialised with random data") {
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        MemoryCard card(data), control(data);
+        AND_GIVEN("A MemoryCardSlot in direct-access mode and one not, with a card inserted into each") {
+            MemoryCardSlot slot, control_slot;
+            slot.set_direct_mode(true);
+            REQUIRE(slot.direct_mode());
+            REQUIRE_FALSE(control_slot.direct_mode());
+            REQUIRE(slot.insert_card(card));
+            REQUIRE(control_slot.insert_card(control));
+            // includes some out-of-range sector numbers, which wrap around in the protocol
+            std::size_t sector_number = GENERATE(0x000u, 0x001u, 0x115u, 0x3FFu, 0x400u, 0x7A5u);
+            WHEN("The same sector is read from both slots") {
+                std::array<Byte, MemoryCard::SECTOR_SIZE> output, control_output;
+                MemoryCardSlot::Result success = slot.read_sector(sector_number, output);
+                MemoryCardSlot::Result control_success = control_slot.read_sector(sector_number, control_output);
+                THEN("Both reads have the same outcome and data") {
+                    REQUIRE(success == control_success);
+                    REQUIRE(output == control_output);
+                }
+            }
+            WHEN("The same data is written to the same sector in both slots") {
+                auto sector = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+                MemoryCardSlot::Result success = slot.write_sector(sector_number, sector);
+                MemoryCardSlot::Result control_success = control_slot.write_sector(sector_number, sector);
+                THEN("Both writes have the same outcome and leave identical card data") {
+                    REQUIRE(success == control_success);
+                    for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                        REQUIRE(card.bytes()[i] == control.bytes()[i]);
+                    }
+                }
+            }
+            WHEN("Both slots are used to read the entire card") {
+                std::array<Byte, MemoryCard::CARD_SIZE> output;
+                REQUIRE(slot.read_card(output));
+                THEN("The data read matches the card data") {
+                    for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                        REQUIRE(output[i] == data[i]);
+                    }
+                }
+                AND_WHEN("A further command sequence is sent to both cards") {
+                    TriState inputs[] = {
+                        0x81, 0x53, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                    };
+                    THEN("Both cards respond identically, as they are in the same state") {
+                        for (TriState command : inputs) {
+                            TriState response = std::nullopt, control_response = std::nullopt;
+                            REQUIRE(slot.send(command, response) == control_slot.send(command, control_response));
+                            REQUIRE(response == control_response);
+                        }
+                    }
+                }
+            }
+            WHEN("Both cards are left in the middle of a transaction before a sector is read") {
+                TriState response = std::nullopt;
+                REQUIRE(slot.send(0x81, response));
+                REQUIRE(control_slot.send(0x81, response));
+                std::array<Byte, MemoryCard::SECTOR_SIZE> output, control_output;
+                MemoryCardSlot::Result success = slot.read_sector(sector_number, output);
+                MemoryCardSlot::Result control_success = control_slot.read_sector(sector_number, control_output);
+                THEN("The direct-access slot falls back to the protocol and gets the same outcome") {
+                    REQUIRE(success == control_success);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("MemoryCardSlot reports why a read or write failed") {
+    GIVEN("An empty MemoryCardSlot") {
+        MemoryCardSlot slot;
+        THEN("Reading or writing fails because there is no card") {
+            std::array<Byte, MemoryCard::SECTOR_SIZE> sector = {};
+            std::array<Byte, MemoryCard::BLOCK_SIZE> block = {};
+            CHECK(slot.read_sector(0x115, sector) == MemoryCardSlot::Result{MemoryCardSlot::Error::NO_CARD, 0x115, 0});
+            CHECK(slot.write_sector(0x115, sector).error == MemoryCardSlot::Error::NO_CARD);
+            CHECK(slot.read_block(3, block) == MemoryCardSlot::Result{MemoryCardSlot::Error::NO_CARD, 3 * 64, 0});
+        }
+    }
+    GIVEN("A MemoryCardSlot with a card inserted") {
+        MemoryCard card;
+        MemoryCardSlot slot;
+        REQUIRE(slot.insert_card(card));
+        std::array<Byte, MemoryCard::SECTOR_SIZE> sector = {};
+        WHEN("A Sector is read successfully") {
+            THEN("No error is reported") {
+                CHECK(slot.read_sector(0x115, sector) == MemoryCardSlot::Result{MemoryCardSlot::Error::NONE, 0x115, 0});
+            }
+        }
+        WHEN("The card has already been sent a Memory Card address byte") {
+            TriState response;
+            REQUIRE(slot.send(0x81, response));
+            THEN("Reading a Sector fails because the card doesn't ACK the first byte") {
+                CHECK(slot.read_sector(0x115, sector) == MemoryCardSlot::Result{MemoryCardSlot::Error::NO_ACK, 0x115, 0});
+            }
+        }
+        WHEN("The card is part-way through a read when a write is started") {
+            TriState response;
+            for (Byte command : {0x81, 0x52, 0x00, 0x00, 0x01, 0x15}) {
+                REQUIRE(slot.send(command, response));
+            }
+            THEN("Writing a Sector fails because the card replies with the wrong bytes") {
+                // the card sends Command Acknowledge where the Memory Card ID is expected
+                CHECK(slot.write_sector(0x020, sector) == MemoryCardSlot::Result{MemoryCardSlot::Error::BAD_RESPONSE, 0x020, 2});
+            }
+        }
+        WHEN("The data being written changes after the card has received it") {
+            DataChanger changer(sector);
+            card.set_observer(&changer);
+            THEN("Writing the Sector fails because the card rejects the checksum the slot sends") {
+                CHECK(slot.write_sector(0x115, sector) == MemoryCardSlot::Result{MemoryCardSlot::Error::BAD_CHECKSUM, 0x115, 137});
+            }
+            card.set_observer(nullptr);
+        }
+        /*
+         * the slot only ever sends Sectors on the card, and the card always
+         * sends the checksum of the data it sent, so the other end statuses
+         * can only be reached by driving the card directly
+         */
+        WHEN("A write with the wrong checksum is sent to the card") {
+            std::vector<TriState> commands = {0x81, 0x57, 0x00, 0x00, 0x01, 0x15};
+            commands.insert(commands.end(), MemoryCard::SECTOR_SIZE, 0x3C);
+            commands.insert(commands.end(), {0x01 ^ 0x15 ^ 0xFF, 0x00, 0x00, 0x00}); // 0x3C cancels itself out
+            std::vector<TriState> responses = send_all(slot, commands);
+            THEN("The card ends with the Bad Checksum status which the slot reports as BAD_CHECKSUM") {
+                CHECK(responses.back() == 0x4E);
+            }
+        }
+        WHEN("A write to a Sector past the end of the card is sent to the card") {
+            std::vector<TriState> commands = {0x81, 0x57, 0x00, 0x00, 0x04, 0x00};
+            commands.insert(commands.end(), MemoryCard::SECTOR_SIZE, 0x3C);
+            commands.insert(commands.end(), {0x04 ^ 0x00, 0x00, 0x00, 0x00});
+            std::vector<TriState> responses = send_all(slot, commands);
+            THEN("The card ends with the Bad Sector status which the slot reports as BAD_SECTOR") {
+                CHECK(responses.back() == 0xFF);
+            }
+        }
+        WHEN("A read of a Sector past the end of the card is sent to the card") {
+            std::vector<TriState> commands = {0x81, 0x52, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00};
+            std::vector<TriState> responses = send_all(slot, commands);
+            THEN("The card confirms the Sector as FFFFh, which the slot reports as BAD_SECTOR") {
+                CHECK(responses[8] == 0xFF);
+                CHECK(responses[9] == 0xFF);
+            }
+        }
+        WHEN("A read is sent to the card and a byte of the data it sends is corrupted") {
+            std::vector<TriState> commands = {0x81, 0x52, 0x00, 0x00, 0x01, 0x15};
+            commands.insert(commands.end(), 4u + MemoryCard::SECTOR_SIZE + 2u, 0x00);
+            std::vector<TriState> responses = send_all(slot, commands);
+            std::array<Byte, MemoryCard::SECTOR_SIZE> received;
+            for (std::size_t i = 0; i < MemoryCard::SECTOR_SIZE; i++) {
+                received[i] = responses[10 + i].value();
+            }
+            received[5] ^= 0x01;
+            THEN("The checksum the card sent no longer matches, which the slot reports as CHECKSUM_MISMATCH") {
+                CHECK(responses[138] != (Byte)(0x01 ^ 0x15 ^ MemoryCard::sector_parity(received)));
+                CHECK(responses[139] == 0x47);
+            }
+        }
+        WHEN("A Block is read from a card that is busy") {
+            TriState response;
+            REQUIRE(slot.send(0x81, response));
+            std::array<Byte, MemoryCard::BLOCK_SIZE> block;
+            THEN("The Sector that failed is reported") {
+                MemoryCardSlot::Result result = slot.read_block(2, block);
+                CHECK_FALSE(result);
+                CHECK(result.sector == 2 * 64);
+                CHECK(result.error == MemoryCardSlot::Error::NO_ACK);
+            }
+        }
+    }
+}
+
+SCENARIO("Whole-card reads and writes can be resumed from where they failed") {
+    GIVEN("A blank MemoryCard inserted into a MemoryCardSlot, and a card's-worth of data") {
+        MemoryCard card;
+        MemoryCardSlot slot;
+        REQUIRE(slot.insert_card(card));
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        WHEN("A write starting part-way through the card fails because the card is busy") {
+            TriState response;
+            REQUIRE(slot.send(0x81, response));
+            MemoryCardSlot::Result result = slot.write_card(data, 500);
+            THEN("The Sector it failed at is reported") {
+                CHECK(result == MemoryCardSlot::Result{MemoryCardSlot::Error::NO_ACK, 500, 0});
+            }
+            AND_WHEN("The write is resumed from that Sector") {
+                MemoryCardSlot::Result resumed = slot.write_card(data, result.sector);
+                THEN("It succeeds, writing only the Sectors from there on") {
+                    CHECK(resumed == MemoryCardSlot::Result{MemoryCardSlot::Error::NONE, MemoryCard::CARD_SECTOR_COUNT, 0});
+                    for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                        REQUIRE(card.bytes()[i] == (i < 500 * MemoryCard::SECTOR_SIZE ? 0x00 : data[i]));
+                    }
+                }
+            }
+        }
+        WHEN("The card is read starting part-way through") {
+            std::array<Byte, MemoryCard::CARD_SIZE> output;
+            output.fill(0xAA);
+            REQUIRE(slot.write_card(data));
+            REQUIRE(slot.read_card(output, 1000));
+            THEN("Only the Sectors from there on are read") {
+                for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                    REQUIRE(output[i] == (i < 1000 * MemoryCard::SECTOR_SIZE ? 0xAA : data[i]));
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Writing only the Sectors of a card which have changed") {
+    GIVEN("A MemoryCard inserted into a MemoryCardSlot, and a copy of its data with some Sectors changed") {
+        auto base = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        MemoryCard card(base);
+        MemoryCardSlot slot;
+        REQUIRE(slot.insert_card(card));
+        card.collect_dirty_sectors();
+        std::array<Byte, MemoryCard::CARD_SIZE> data = base;
+        for (std::size_t sector : {0x003u, 0x140u, 0x3FFu}) {
+            data[sector * MemoryCard::SECTOR_SIZE + 7] ^= 0xFF;
+        }
+        WHEN("The data is written to the card with MemoryCardSlot.write_card_delta()") {
+            REQUIRE(slot.write_card_delta(data, base));
+            THEN("The card holds the new data") {
+                CHECK(std::equal(data.begin(), data.end(), card.bytes().begin()));
+            }
+            THEN("Only the changed Sectors were written") {
+                SectorBitmap written = card.collect_dirty_sectors();
+                CHECK(written.count() == 3);
+                CHECK(written.test(0x003));
+                CHECK(written.test(0x140));
+                CHECK(written.test(0x3FF));
+            }
+        }
+    }
+}
+
+SCENARIO("MemoryCardSlot can cache Sectors of the inserted card") {
+    GIVEN("A MemoryCardSlot with a Sector cache, and a card inserted") {
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        MemoryCard card(data);
+        MemoryCardSlot slot;
+        slot.set_cache_capacity(16);
+        REQUIRE(slot.cache_capacity() == 16);
+        REQUIRE(slot.insert_card(card));
+        std::array<Byte, MemoryCard::SECTOR_SIZE> output;
+        WHEN("A Sector is read twice") {
+            REQUIRE(slot.read_sector(0x001, output));
+            REQUIRE(slot.read_sector(0x001, output));
+            THEN("The second read is answered from the cache") {
+                CHECK(std::equal(output.begin(), output.end(), data.begin() + MemoryCard::SECTOR_SIZE));
+                MemoryCardSlot::CacheStats stats = slot.cache_stats();
+                CHECK(stats.hits == 1);
+                CHECK(stats.misses == 1);
+                CHECK(stats.bytes_saved == 140);
+                CHECK(stats.hit_ratio() == 0.5);
+            }
+        }
+        WHEN("A Sector is written and then read") {
+            auto sector = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+            sector[0] ^= 0xFF;
+            REQUIRE(slot.write_sector(0x002, sector));
+            REQUIRE(slot.read_sector(0x002, output));
+            THEN("The read is answered from the cache, with the data written") {
+                CHECK(slot.cache_stats().hits == 1);
+                CHECK(output == sector);
+            }
+        }
+        WHEN("A Sector is read after a write, the card is power-cycled and changed behind the slot's back") {
+            REQUIRE(slot.write_sector(0x03F, output));
+            REQUIRE(slot.read_sector(0x001, output));
+            card.power_off();
+            card.get_sector(0x001)[0] ^= 0xFF;
+            card.power_on();
+            // the next transaction with the card sees the FLAG has been set again
+            std::array<Byte, MemoryCard::SECTOR_SIZE> other;
+            REQUIRE(slot.read_sector(0x004, other));
+            REQUIRE(slot.read_sector(0x001, output));
+            THEN("The cache is emptied, so the changed data is read from the card") {
+                CHECK(slot.cache_stats().hits == 0);
+                CHECK(output[0] == (Byte)(data[MemoryCard::SECTOR_SIZE] ^ 0xFF));
+            }
+        }
+        WHEN("A Sector is read, then changed through the card's get_sector()") {
+            REQUIRE(slot.read_sector(0x001, output));
+            card.get_sector(0x001)[0] ^= 0xFF;
+            REQUIRE(slot.read_sector(0x001, output));
+            THEN("The changed data is read from the card") {
+                CHECK(slot.cache_stats().hits == 0);
+                CHECK(output[0] == (Byte)(data[MemoryCard::SECTOR_SIZE] ^ 0xFF));
+            }
+        }
+        WHEN("A Sector is read, then changed through a view kept from before and marked dirty") {
+            auto view = card.bytes();
+            REQUIRE(slot.read_sector(0x001, output));
+            REQUIRE(slot.read_sector(0x002, output));
+            view[MemoryCard::SECTOR_SIZE] ^= 0xFF;
+            card.mark_dirty(0x001);
+            REQUIRE(slot.read_sector(0x001, output));
+            THEN("The changed data is read from the card") {
+                CHECK(output[0] == (Byte)(data[MemoryCard::SECTOR_SIZE] ^ 0xFF));
+                AND_THEN("Other Sectors are still cached") {
+                    REQUIRE(slot.read_sector(0x002, output));
+                    CHECK(slot.cache_stats().hits == 1);
+                }
+            }
+        }
+        WHEN("A Sector is read, and the card is removed and inserted again") {
+            REQUIRE(slot.read_sector(0x001, output));
+            REQUIRE(slot.remove_card());
+            REQUIRE(slot.insert_card(card));
+            REQUIRE(slot.read_sector(0x001, output));
+            THEN("The cache was emptied") {
+                CHECK(slot.cache_stats().hits == 0);
+            }
+        }
+        WHEN("A Sector is read, then bytes are sent to the card directly") {
+            REQUIRE(slot.read_sector(0x001, output));
+            TriState response;
+            slot.send(0x01, response);
+            REQUIRE(slot.read_sector(0x001, output));
+            THEN("The cache was emptied") {
+                CHECK(slot.cache_stats().hits == 0);
+            }
+        }
+    }
+}
@@ -0,0 +1,61 @@
+#include <memory>
+
+#include <cstddef>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
+#include <wondercard/PagedCardStorage.hpp>
+
+#include "test_helpers.hpp"
+
+
+using namespace com::saxbophone::wondercard;
+using namespace com::saxbophone::wondercard::PRIVATE::test_helpers;
+
+SCENARIO("MemoryCards can be backed by sparse, lazily-allocated storage") {
+    GIVEN("A MemoryCard with paged storage") {
+        MemoryCard card(std::make_unique<PagedCardStorage>());
+        THEN("The card data is all zeroes") {
+            for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                REQUIRE(card.bytes()[i] == 0x00);
+            }
+        }
+        THEN("The card data takes up much less memory than the whole card") {
+            MemoryCard::MemoryUsage usage = card.memory_usage();
+            CHECK(usage.object_size == sizeof(MemoryCard));
+            CHECK(usage.data_size < MemoryCard::CARD_SIZE / 10);
+        }
+        WHEN("A sector is written to the card through the protocol") {
+            auto sector = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+            std::size_t sector_number = GENERATE(0x000u, 0x115u, 0x3FFu);
+            MemoryCardSlot slot;
+            REQUIRE(slot.insert_card(card));
+            REQUIRE(slot.write_sector(sector_number, sector));
+            THEN("The sector can be read back and the rest of the card is still zeroes") {
+                MemoryCard::Sector written = card.get_sector(sector_number);
+                for (std::size_t i = 0; i < MemoryCard::SECTOR_SIZE; i++) {
+                    REQUIRE(written[i] == sector[i]);
+                }
+                for (std::size_t i = 0; i < MemoryCard::CARD_SIZE; i++) {
+                    if (i / MemoryCard::SECTOR_SIZE != sector_number) {
+                        REQUIRE(card.bytes()[i] == 0x00);
+                    }
+                }
+            }
+            THEN("Only a small part of the card data takes up memory") {
+                MemoryCard::MemoryUsage usage = card.memory_usage();
+                CHECK(usage.data_size > 0);
+                CHECK(usage.data_size < MemoryCard::CARD_SIZE / 10);
+            }
+        }
+    }
+    GIVEN("A MemoryCard with the default storage") {
+        MemoryCard card;
+        THEN("All of the card data takes up memory") {
+            CHECK(card.memory_usage().data_size == MemoryCard::CARD_SIZE);
+        }
+    }
+}
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <array>
+#include <initializer_list>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/ProtocolDecoder.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+
+#include "test_helpers.hpp"
+
+
+using namespace com::saxbophone::wondercard;
+using namespace com::saxbophone::wondercard::PRIVATE::test_helpers;
+
+namespace {
+    // sends the given bytes to the card, recording what was exchanged
+    void exchange(MemoryCard& card, std::vector<TriState> mosi, std::vector<ProtocolTrace::Record>& records) {
+        for (TriState command : mosi) {
+            TriState response;
+            bool ack = card.send(command, response);
+            records.push_back({command, response, ack});
+        }
+    }
+
+    // the bytes of a write sector transaction, with the correct checksum unless told otherwise
+    std::vector<TriState> write_command(std::uint16_t sector, const std::array<Byte, MemoryCard::SECTOR_SIZE>& data, Byte checksum_error = 0x00) {
+        std::vector<TriState> mosi = {0x81, 0x57, 0x00, 0x00, (Byte)(sector >> 8), (Byte)(sector & 0xFF)};
+        Byte checksum = (Byte)(sector >> 8) ^ (Byte)(sector & 0xFF);
+        for (Byte byte : data) {
+            mosi.push_back(byte);
+            checksum ^= byte;
+        }
+        mosi.push_back((Byte)(checksum ^ checksum_error));
+        mosi.insert(mosi.end(), {0x00, 0x00, 0x00});
+        return mosi;
+    }
+
+    std::vector<TriState> read_command(std::uint16_t sector) {
+        std::vector<TriState> mosi = {0x81, 0x52, 0x00, 0x00, (Byte)(sector >> 8), (Byte)(sector & 0xFF)};
+        mosi.resize(140, 0x00);
+        return mosi;
+    }
+
+    std::vector<ProtocolDecoder::Event> decode_all(ProtocolDecoder& decoder, const std::vector<ProtocolTrace::Record>& records) {
+        std::vector<ProtocolDecoder::Event> events;
+        decoder.decode(records, [&](const ProtocolDecoder::Event& event) {
+            events.push_back(event);
+        });
+        return events;
+    }
+}
+
+SCENARIO("ProtocolDecoder works out which transactions took place from the bytes exchanged") {
+    GIVEN("A powered-on MemoryCard and a ProtocolDecoder") {
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        MemoryCard card(data);
+        REQUIRE(card.power_on());
+        ProtocolDecoder decoder;
+        std::vector<ProtocolTrace::Record> records;
+        WHEN("A Sector is read from the card") {
+            exchange(card, read_command(0x0115), records);
+            auto events = decode_all(decoder, records);
+            THEN("A successful read of that Sector is decoded, with its data") {
+                REQUIRE(events.size() == 1);
+                CHECK(events[0] == ProtocolDecoder::Event{ProtocolDecoder::EventKind::READ_SECTOR, 0x52, 0x08, 0x47, true, 0x0115, 140, 0});
+                auto sector = decoder.sector_data();
+                CHECK(std::equal(sector.begin(), sector.end(), data.begin() + 0x0115 * MemoryCard::SECTOR_SIZE));
+            }
+        }
+        WHEN("A Sector beyond the end of the card is read") {
+            exchange(card, read_command(0x0400), records);
+            auto events = decode_all(decoder, records);
+            THEN("A read of a bad Sector is decoded") {
+                REQUIRE(events.size() == 1);
+                CHECK(events[0].kind == ProtocolDecoder::EventKind::READ_SECTOR);
+                CHECK(events[0].status == 0xFF);
+                CHECK(events[0].sector == 0x0400);
+                CHECK(events[0].length == 10);
+            }
+        }
+        WHEN("Sectors are written with a good checksum, a bad checksum and to a bad Sector") {
+            std::array<Byte, MemoryCard::SECTOR_SIZE> sector = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+            exchange(card, write_command(0x0020, sector), records);
+            exchange(card, write_command(0x0021, sector, 0x10), records);
+            exchange(card, write_command(0x0500, sector), records);
+            auto events = decode_all(decoder, records);
+            THEN("Each write is decoded with the status the card replied with") {
+                REQUIRE(events.size() == 3);
+                CHECK(events[0] == ProtocolDecoder::Event{ProtocolDecoder::EventKind::WRITE_SECTOR, 0x57, 0x08, 0x47, true, 0x0020, 138, 0});
+                // a successful write clears the FLAG
+                CHECK(events[1] == ProtocolDecoder::Event{ProtocolDecoder::EventKind::WRITE_SECTOR, 0x57, 0x00, 0x4E, false, 0x0021, 138, 138});
+                CHECK(events[2].status == 0xFF);
+                CHECK(events[2].sector == 0x0500);
+                CHECK(events[2].start == 276);
+                CHECK(std::equal(sector.begin(), sector.end(), decoder.sector_data().begin()));
+            }
+        }
+        WHEN("The card's ID is requested") {
+            exchange(card, {0x81, 0x53, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, records);
+            auto events = decode_all(decoder, records);
+            THEN("A Get ID transaction is decoded") {
+                REQUIRE(events.size() == 1);
+                CHECK(events[0].kind == ProtocolDecoder::EventKind::GET_ID);
+                CHECK(events[0].length == 10);
+            }
+        }
+        WHEN("A command the card doesn't know is sent") {
+            exchange(card, {0x81, 0x99}, records);
+            auto events = decode_all(decoder, records);
+            THEN("An unknown command is decoded") {
+                REQUIRE(events.size() == 1);
+                CHECK(events[0].kind == ProtocolDecoder::EventKind::UNKNOWN_COMMAND);
+                CHECK(events[0].command == 0x99);
+            }
+        }
+        WHEN("Bytes not meant for a Memory Card are sent between transactions") {
+            exchange(card, {0x01, 0x42, 0x00}, records);
+            exchange(card, read_command(0x0003), records);
+            auto events = decode_all(decoder, records);
+            THEN("They are ignored") {
+                REQUIRE(events.size() == 1);
+                CHECK(events[0].kind == ProtocolDecoder::EventKind::READ_SECTOR);
+                CHECK(events[0].start == 3);
+            }
+        }
+        WHEN("The card stops ACKing part-way through a transaction") {
+            exchange(card, read_command(0x0003), records);
+            records.resize(50);
+            records.back().ack = false;
+            auto events = decode_all(decoder, records);
+            THEN("An aborted transaction is decoded") {
+                REQUIRE(events.size() == 1);
+                CHECK(events[0].kind == ProtocolDecoder::EventKind::ABORTED);
+                CHECK(events[0].command == 0x52);
+                CHECK(events[0].length == 50);
+            }
+        }
+    }
+}
@@ -0,0 +1,135 @@
+#include <array>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+
+#include "test_helpers.hpp"
+
+
+using namespace com::saxbophone::wondercard;
+using namespace com::saxbophone::wondercard::PRIVATE::test_helpers;
+
+SCENARIO("ProtocolTrace holds records in order until they are drained") {
+    GIVEN("A ProtocolTrace with a capacity that isn't a power of two") {
+        ProtocolTrace trace(6);
+        THEN("Its capacity is rounded up to a power of two") {
+            CHECK(trace.capacity() == 8);
+        }
+        WHEN("More records are pushed than it can hold") {
+            for (std::size_t i = 0; i < 10; i++) {
+                trace.push({(Byte)i, std::nullopt, true});
+            }
+            THEN("The extra records are dropped") {
+                CHECK(trace.size() == 8);
+                CHECK(trace.dropped() == 2);
+            }
+            AND_WHEN("The records are drained") {
+                std::array<ProtocolTrace::Record, 16> records;
+                std::size_t count = trace.drain(records);
+                THEN("The records which were kept come out in the order they went in") {
+                    REQUIRE(count == 8);
+                    for (std::size_t i = 0; i < count; i++) {
+                        CHECK(records[i].mosi == (Byte)i);
+                    }
+                    CHECK(trace.size() == 0);
+                }
+            }
+        }
+    }
+    GIVEN("A ProtocolTrace which is pushed to by one thread and drained by another") {
+        ProtocolTrace trace(64);
+        constexpr std::size_t COUNT = 20000;
+        std::thread producer([&] {
+            for (std::size_t i = 0; i < COUNT; i++) {
+                // spin until there is room, so no records are dropped
+                while (not trace.push({(Byte)i, (Byte)(i >> 8), (i & 1u) == 0})) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        std::vector<ProtocolTrace::Record> received;
+        std::array<ProtocolTrace::Record, 16> records;
+        while (received.size() < COUNT) {
+            std::size_t count = trace.drain(records);
+            if (count == 0) {
+                std::this_thread::yield();
+            }
+            received.insert(received.end(), records.begin(), records.begin() + (std::ptrdiff_t)count);
+        }
+        producer.join();
+        THEN("Every record is received, in order") {
+            for (std::size_t i = 0; i < COUNT; i++) {
+                REQUIRE(received[i] == ProtocolTrace::Record{(Byte)i, (Byte)(i >> 8), (i & 1u) == 0});
+            }
+        }
+    }
+}
+
+SCENARIO("MemoryCardSlot can record the bytes exchanged with a card into a ProtocolTrace") {
+    GIVEN("A MemoryCardSlot with a card inserted and a trace attached") {
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        MemoryCard card(data);
+        MemoryCardSlot slot;
+        REQUIRE(slot.insert_card(card));
+        ProtocolTrace trace(1024);
+        slot.set_trace(&trace);
+        std::vector<ProtocolTrace::Record> records(trace.capacity());
+        WHEN("A Sector is read from the card") {
+            std::array<Byte, MemoryCard::SECTOR_SIZE> sector;
+            REQUIRE(slot.read_sector(0x115, sector));
+            records.resize(trace.drain(records));
+            if (MemoryCardSlot::trace_supported()) {
+                THEN("Every byte of the read transaction has been recorded") {
+                    REQUIRE(records.size() == 140);
+                    CHECK(records[0] == ProtocolTrace::Record{0x81, std::nullopt, true});
+                    CHECK(records[4].mosi == 0x01);
+                    CHECK(records[5].mosi == 0x15);
+                    for (std::size_t i = 0; i < MemoryCard::SECTOR_SIZE; i++) {
+                        REQUIRE(records[10 + i].miso == sector[i]);
+                    }
+                    CHECK(records[139] == ProtocolTrace::Record{0x00, 0x47, false});
+                }
+            } else {
+                THEN("Nothing has been recorded") {
+                    CHECK(records.empty());
+                }
+            }
+        }
+        WHEN("A byte is sent with send()") {
+            TriState response;
+            slot.send(0x01, response);
+            records.resize(trace.drain(records));
+            if (MemoryCardSlot::trace_supported()) {
+                THEN("The byte has been recorded") {
+                    REQUIRE(records.size() == 1);
+                    CHECK(records[0] == ProtocolTrace::Record{0x01, std::nullopt, false});
+                }
+            }
+        }
+        WHEN("A Sector is read in direct-access mode") {
+            slot.set_direct_mode(true);
+            std::array<Byte, MemoryCard::SECTOR_SIZE> sector;
+            REQUIRE(slot.read_sector(0x115, sector));
+            THEN("Nothing has been recorded") {
+                CHECK(trace.size() == 0);
+            }
+        }
+        WHEN("The trace is detached and a Sector is read") {
+            slot.set_trace(nullptr);
+            std::array<Byte, MemoryCard::SECTOR_SIZE> sector;
+            REQUIRE(slot.read_sector(0x115, sector));
+            THEN("Nothing has been recorded") {
+                CHECK(trace.size() == 0);
+            }
+        }
+    }
+}
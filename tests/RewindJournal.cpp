@@ -0,0 +1,127 @@
+#include <array>
+#include <vector>
+
+#include <cstddef>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
+#include <wondercard/RewindJournal.hpp>
+
+#include "test_helpers.hpp"
+
+
+using namespace com::saxbophone::wondercard;
+using namespace com::saxbophone::wondercard::PRIVATE::test_helpers;
+
+namespace {
+    // copies the entire contents of the given card
+    std::vector<Byte> card_contents(const MemoryCard& card) {
+        return std::vector<Byte>(card.bytes().begin(), card.bytes().end());
+    }
+}
+
+SCENARIO("MemoryCards can be rewound to an earlier point with a RewindJournal") {
+    GIVEN("A MemoryCard with random data, inserted into a slot, with a journal attached") {
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        MemoryCard card(data);
+        RewindJournal journal(64);
+        card.set_journal(&journal);
+        MemoryCardSlot slot;
+        REQUIRE(slot.insert_card(card));
+        AND_GIVEN("A marker made before some Sectors are written to") {
+            RewindJournal::Marker marker = journal.mark(card);
+            auto before = card_contents(card);
+            auto sector = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+            std::size_t sector_number = GENERATE(0x000u, 0x115u, 0x3FFu);
+            REQUIRE(slot.write_sector(sector_number, sector));
+            REQUIRE(slot.write_sector(sector_number, sector));
+            REQUIRE(slot.write_sector(0x0FF, sector));
+            THEN("Writing the same Sector again since the marker is only recorded once") {
+                CHECK(journal.size() == (sector_number == 0x0FF ? 1u : 2u));
+            }
+            WHEN("The card is rewound to the marker") {
+                REQUIRE(journal.rewind_to(card, marker));
+                THEN("The card data is as it was when the marker was made") {
+                    CHECK(card_contents(card) == before);
+                }
+                THEN("The card still works through the slot") {
+                    std::array<Byte, MemoryCard::SECTOR_SIZE> read_back;
+                    REQUIRE(slot.read_sector(sector_number, read_back));
+                    for (std::size_t i = 0; i < MemoryCard::SECTOR_SIZE; i++) {
+                        REQUIRE(read_back[i] == before[sector_number * MemoryCard::SECTOR_SIZE + i]);
+                    }
+                }
+            }
+        }
+        AND_GIVEN("Several markers, each followed by different writes") {
+            std::vector<RewindJournal::Marker> markers;
+            std::vector<std::vector<Byte>> contents;
+            for (std::size_t m = 0; m < 4; m++) {
+                markers.push_back(journal.mark(card));
+                contents.push_back(card_contents(card));
+                auto sector = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+                REQUIRE(slot.write_sector(0x100 + m, sector));
+                REQUIRE(slot.write_sector(0x200, sector));
+            }
+            WHEN("The card is rewound to a marker in the middle") {
+                REQUIRE(journal.rewind_to(card, markers[1]));
+                THEN("The card data is as it was when that marker was made") {
+                    CHECK(card_contents(card) == contents[1]);
+                }
+                THEN("Later markers can no longer be rewound to, but earlier ones can") {
+                    CHECK_FALSE(journal.can_rewind_to(markers[3]));
+                    REQUIRE(journal.rewind_to(card, markers[0]));
+                    CHECK(card_contents(card) == contents[0]);
+                }
+            }
+        }
+        AND_GIVEN("A marker followed by more writes than the journal can hold") {
+            RewindJournal::Marker marker = journal.mark(card);
+            auto sector = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+            for (std::size_t s = 0; s < 65; s++) {
+                REQUIRE(slot.write_sector(s, sector));
+            }
+            THEN("The marker can no longer be rewound to") {
+                CHECK_FALSE(journal.can_rewind_to(marker));
+                CHECK_FALSE(journal.rewind_to(card, marker));
+            }
+        }
+        AND_GIVEN("A marker made part-way through writing a Sector") {
+            std::vector<TriState> inputs = {0x81, 0x57, 0x00, 0x00, 0x00, 0x07};
+            inputs.insert(inputs.end(), MemoryCard::SECTOR_SIZE, 0xAA);
+            inputs.insert(inputs.end(), {0x07, 0x00, 0x00, 0x00}); // 0xAA cancels itself out of the checksum
+            // half-way through the data, and once all of it has been sent
+            std::size_t split = GENERATE(6u + 64u, 6u + 128u);
+            TriState response;
+            for (std::size_t i = 0; i < split; i++) {
+                slot.send(inputs[i], response);
+            }
+            RewindJournal::Marker marker = journal.mark(card);
+            auto before = card_contents(card);
+            for (std::size_t i = split; i < inputs.size(); i++) {
+                slot.send(inputs[i], response);
+            }
+            REQUIRE(response == 0x47);
+            WHEN("The card is rewound to the marker") {
+                REQUIRE(journal.rewind_to(card, marker));
+                THEN("The Sector is as it was when the marker was made, not as it was left by the write") {
+                    CHECK(card_contents(card) == before);
+                }
+                AND_WHEN("The rest of the write is sent again and the card is rewound to the same marker again") {
+                    for (std::size_t i = split; i < inputs.size(); i++) {
+                        slot.send(inputs[i], response);
+                    }
+                    REQUIRE(response == 0x47);
+                    REQUIRE(journal.rewind_to(card, marker));
+                    THEN("The Sector is again as it was when the marker was made") {
+                        CHECK(card_contents(card) == before);
+                    }
+                }
+            }
+        }
+        card.set_journal(nullptr);
+    }
+}
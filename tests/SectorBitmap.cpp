@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <vector>
+
+#include <cstddef>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/SectorBitmap.hpp>
+
+
+using namespace com::saxbophone::wondercard;
+
+SCENARIO("SectorBitmap stores a set of Sectors") {
+    GIVEN("An empty SectorBitmap") {
+        SectorBitmap bitmap;
+        THEN("It contains no Sectors") {
+            CHECK_FALSE(bitmap.any());
+            CHECK(bitmap.count() == 0);
+            CHECK(bitmap.find_next(0) == SectorBitmap::SECTOR_COUNT);
+        }
+        WHEN("Some Sectors are added to it") {
+            std::vector<std::size_t> sectors = {0, 1, 63, 64, 65, 500, 1023};
+            for (std::size_t sector : sectors) {
+                bitmap.set(sector);
+            }
+            THEN("It contains exactly those Sectors") {
+                CHECK(bitmap.any());
+                CHECK(bitmap.count() == sectors.size());
+                for (std::size_t sector = 0; sector < SectorBitmap::SECTOR_COUNT; sector++) {
+                    bool expected = std::find(sectors.begin(), sectors.end(), sector) != sectors.end();
+                    REQUIRE(bitmap.test(sector) == expected);
+                }
+            }
+            THEN("Iterating over it visits those Sectors in ascending order") {
+                std::vector<std::size_t> visited;
+                bitmap.for_each([&](std::size_t sector) { visited.push_back(sector); });
+                CHECK(visited == sectors);
+            }
+            THEN("Searching for the next Sector finds the right one") {
+                CHECK(bitmap.find_next(2) == 63);
+                CHECK(bitmap.find_next(64) == 64);
+                CHECK(bitmap.find_next(66) == 500);
+                CHECK(bitmap.find_next(1024) == SectorBitmap::SECTOR_COUNT);
+            }
+            AND_WHEN("One of them is removed") {
+                bitmap.reset(64);
+                THEN("It no longer contains that Sector") {
+                    CHECK_FALSE(bitmap.test(64));
+                    CHECK(bitmap.count() == sectors.size() - 1);
+                }
+            }
+            AND_WHEN("It is cleared") {
+                bitmap.clear();
+                THEN("It is equal to an empty SectorBitmap") {
+                    CHECK(bitmap == SectorBitmap());
+                }
+            }
+            AND_WHEN("It is combined with another SectorBitmap") {
+                SectorBitmap other;
+                other.set(2);
+                other.set(63);
+                bitmap |= other;
+                THEN("It contains the Sectors of both") {
+                    CHECK(bitmap.test(2));
+                    CHECK(bitmap.count() == sectors.size() + 1);
+                }
+            }
+        }
+    }
+}
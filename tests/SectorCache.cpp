@@ -0,0 +1,82 @@
+#include <array>
+
+#include <cstddef>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/SectorCache.hpp>
+
+
+using namespace com::saxbophone::wondercard;
+
+namespace {
+    std::array<Byte, MemoryCard::SECTOR_SIZE> filled(Byte value) {
+        std::array<Byte, MemoryCard::SECTOR_SIZE> sector;
+        sector.fill(value);
+        return sector;
+    }
+}
+
+SCENARIO("SectorCache keeps the most recently used Sectors") {
+    GIVEN("A SectorCache with room for three Sectors, holding three Sectors") {
+        SectorCache cache(3);
+        cache.put(0x010, filled(0x10));
+        cache.put(0x020, filled(0x20));
+        cache.put(0x030, filled(0x30));
+        std::array<Byte, MemoryCard::SECTOR_SIZE> output = {};
+        THEN("All three can be looked up") {
+            CHECK(cache.size() == 3);
+            REQUIRE(cache.get(0x010, output));
+            CHECK(output == filled(0x10));
+            REQUIRE(cache.get(0x030, output));
+            CHECK(output == filled(0x30));
+        }
+        THEN("Sectors it doesn't hold can't be looked up") {
+            CHECK_FALSE(cache.get(0x040, output));
+            CHECK(output == filled(0x00));
+        }
+        WHEN("The oldest Sector is looked up and then another Sector is added") {
+            REQUIRE(cache.get(0x010, output));
+            cache.put(0x040, filled(0x40));
+            THEN("The least recently used Sector is thrown away to make room") {
+                CHECK(cache.size() == 3);
+                CHECK_FALSE(cache.get(0x020, output));
+                CHECK(cache.get(0x010, output));
+                CHECK(cache.get(0x030, output));
+                CHECK(cache.get(0x040, output));
+            }
+        }
+        WHEN("A Sector it holds is updated") {
+            cache.put(0x020, filled(0x22));
+            THEN("The new data is looked up") {
+                CHECK(cache.size() == 3);
+                REQUIRE(cache.get(0x020, output));
+                CHECK(output == filled(0x22));
+            }
+        }
+        WHEN("A Sector is erased and then two more are added") {
+            cache.erase(0x020);
+            CHECK(cache.size() == 2);
+            cache.put(0x040, filled(0x40));
+            cache.put(0x050, filled(0x50));
+            THEN("The erased Sector's room was reused before anything else was thrown away") {
+                CHECK_FALSE(cache.get(0x020, output));
+                CHECK_FALSE(cache.get(0x010, output));
+                CHECK(cache.get(0x030, output));
+                CHECK(cache.get(0x040, output));
+                CHECK(cache.get(0x050, output));
+            }
+        }
+        WHEN("It is cleared") {
+            cache.clear();
+            THEN("It holds nothing, but can be filled again") {
+                CHECK(cache.size() == 0);
+                CHECK_FALSE(cache.get(0x010, output));
+                cache.put(0x060, filled(0x60));
+                CHECK(cache.get(0x060, output));
+            }
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#include <array>
+#include <memory>
+#include <utility>
+
+#include <cstddef>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
+#include <wondercard/SpanCardStorage.hpp>
+
+#include "test_helpers.hpp"
+
+
+using namespace com::saxbophone::wondercard;
+using namespace com::saxbophone::wondercard::PRIVATE::test_helpers;
+
+SCENARIO("MemoryCards can work directly on memory owned by the caller") {
+    GIVEN("A buffer containing random data") {
+        auto buffer = std::make_unique<std::array<Byte, MemoryCard::CARD_SIZE>>(
+            generate_random_bytes<MemoryCard::CARD_SIZE>()
+        );
+        WHEN("A MemoryCard is created which uses the buffer as its storage") {
+            MemoryCard card = MemoryCard::with_storage<SpanCardStorage>(*buffer);
+            THEN("The card data is the buffer itself, not a copy of it") {
+                CHECK(std::as_const(card).bytes().data() == buffer->data());
+            }
+            AND_WHEN("A sector is read through a MemoryCardSlot, then changed in the buffer by its owner") {
+                MemoryCardSlot slot;
+                REQUIRE(slot.insert_card(card));
+                std::array<Byte, MemoryCard::SECTOR_SIZE> sector;
+                REQUIRE(slot.read_sector(3, sector));
+                (*buffer)[3 * MemoryCard::SECTOR_SIZE + 10] ^= 0xFF;
+                THEN("Reading the sector again gives the new data, with a valid checksum") {
+                    REQUIRE(slot.read_sector(3, sector));
+                    CHECK(sector[10] == (*buffer)[3 * MemoryCard::SECTOR_SIZE + 10]);
+                }
+                THEN("Reading it again through a slot with a cache gives the new data once marked dirty") {
+                    REQUIRE(slot.remove_card());
+                    slot.set_cache_capacity(4);
+                    REQUIRE(slot.insert_card(card));
+                    REQUIRE(slot.read_sector(3, sector));
+                    (*buffer)[3 * MemoryCard::SECTOR_SIZE + 10] ^= 0x0F;
+                    card.mark_dirty(3);
+                    REQUIRE(slot.read_sector(3, sector));
+                    CHECK(sector[10] == (*buffer)[3 * MemoryCard::SECTOR_SIZE + 10]);
+                }
+            }
+            AND_WHEN("A sector is written to the card through the protocol") {
+                auto sector = generate_random_bytes<MemoryCard::SECTOR_SIZE>();
+                std::size_t sector_number = GENERATE(0x000u, 0x115u, 0x3FFu);
+                MemoryCardSlot slot;
+                REQUIRE(slot.insert_card(card));
+                REQUIRE(slot.write_sector(sector_number, sector));
+                THEN("The sector has been written to the buffer") {
+                    for (std::size_t i = 0; i < MemoryCard::SECTOR_SIZE; i++) {
+                        REQUIRE((*buffer)[sector_number * MemoryCard::SECTOR_SIZE + i] == sector[i]);
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+#include <wondercard/TraceFile.hpp>
+
+
+using namespace com::saxbophone::wondercard;
+
+SCENARIO("Records written to a trace file can be read back again") {
+    GIVEN("Some records covering every combination of driven bytes and ACK") {
+        std::vector<ProtocolTrace::Record> records;
+        for (std::size_t i = 0; i < 10000; i++) {
+            records.push_back({
+                (i & 1u) ? TriState((Byte)i) : TriState(),
+                (i & 2u) ? TriState((Byte)(i >> 2)) : TriState(),
+                (i & 4u) != 0
+            });
+        }
+        WHEN("They are written to a trace file") {
+            std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+            TraceWriter writer(stream);
+            REQUIRE(writer.write(records));
+            THEN("The file is the header followed by one entry per record") {
+                CHECK(stream.str().size() == TraceFile::MAGIC.size() + records.size() * TraceFile::RECORD_SIZE);
+            }
+            AND_WHEN("The file is read back") {
+                TraceReader reader(stream);
+                std::vector<ProtocolTrace::Record> read = reader.read_all();
+                THEN("The same records are read") {
+                    CHECK(reader.valid());
+                    CHECK(read == records);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("Invalid trace files are detected") {
+    GIVEN("A file which doesn't start with the trace file header") {
+        std::stringstream stream(std::string("NOTATRACE\x00\x01\x02", 12), std::ios::in | std::ios::binary);
+        WHEN("It is read") {
+            TraceReader reader(stream);
+            THEN("It is not valid and no records are read") {
+                CHECK_FALSE(reader.valid());
+                CHECK(reader.read_all().empty());
+            }
+        }
+    }
+    GIVEN("A trace file which ends part-way through a record") {
+        std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+        TraceWriter writer(stream);
+        std::vector<ProtocolTrace::Record> records(5, {0x81, std::nullopt, true});
+        REQUIRE(writer.write(records));
+        std::string truncated = stream.str();
+        truncated.pop_back();
+        std::stringstream input(truncated, std::ios::in | std::ios::binary);
+        WHEN("It is read") {
+            TraceReader reader(input);
+            std::vector<ProtocolTrace::Record> read = reader.read_all();
+            THEN("The whole records are read, but it is not valid") {
+                CHECK(read.size() == 4);
+                CHECK_FALSE(reader.valid());
+            }
+        }
+    }
+}
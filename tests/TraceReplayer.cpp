@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <array>
+#include <span>
+#include <sstream>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <catch2/catch.hpp>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+#include <wondercard/TraceFile.hpp>
+#include <wondercard/TraceReplayer.hpp>
+
+#include "test_helpers.hpp"
+
+
+using namespace com::saxbophone::wondercard;
+using namespace com::saxbophone::wondercard::PRIVATE::test_helpers;
+
+SCENARIO("Recorded protocol traffic can be replayed to a MemoryCard") {
+    GIVEN("The traffic recorded while reading and writing Blocks of a card") {
+        if (not MemoryCardSlot::trace_supported()) {
+            WARN("Protocol tracing is not enabled in this build");
+            return;
+        }
+        auto data = generate_random_bytes<MemoryCard::CARD_SIZE>();
+        MemoryCard card(data);
+        MemoryCardSlot slot;
+        REQUIRE(slot.insert_card(card));
+        ProtocolTrace trace(65536);
+        slot.set_trace(&trace);
+        std::array<Byte, MemoryCard::BLOCK_SIZE> block;
+        REQUIRE(slot.read_block(3, block));
+        block[0x1234] ^= 0xFF;
+        REQUIRE(slot.write_block(5, block));
+        REQUIRE(slot.read_block(5, block));
+        std::vector<ProtocolTrace::Record> records(trace.capacity());
+        records.resize(trace.drain(records));
+        REQUIRE(trace.dropped() == 0);
+        AND_GIVEN("A card with the same contents as the card it was recorded from") {
+            MemoryCard replay_card(data);
+            replay_card.power_on();
+            TraceReplayer replayer(replay_card);
+            WHEN("The traffic is replayed to it") {
+                bool matched = replayer.replay(records);
+                THEN("The card responds to all of it as recorded") {
+                    CHECK(matched);
+                    CHECK(replayer.result().replayed == records.size());
+                    CHECK_FALSE(replayer.result().diverged);
+                }
+                THEN("The card ends up with the same contents as the one it was recorded from") {
+                    CHECK(std::equal(card.bytes().begin(), card.bytes().end(), replay_card.bytes().begin()));
+                }
+            }
+            WHEN("The traffic is replayed to it in pieces") {
+                std::size_t split = records.size() / 3;
+                REQUIRE(replayer.replay(std::span(records).first(split)));
+                REQUIRE(replayer.replay(std::span(records).subspan(split)));
+                THEN("The card responds to all of it as recorded") {
+                    CHECK(replayer.result().replayed == records.size());
+                }
+            }
+            WHEN("The traffic is replayed to it from a trace file") {
+                std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+                TraceWriter writer(stream);
+                REQUIRE(writer.write(records));
+                TraceReader reader(stream);
+                bool matched = replayer.replay(reader);
+                THEN("The card responds to all of it as recorded") {
+                    CHECK(matched);
+                    CHECK(replayer.result().replayed == records.size());
+                }
+            }
+        }
+        AND_GIVEN("A card with one byte different to the card it was recorded from") {
+            data[3 * MemoryCard::BLOCK_SIZE + 300] ^= 0x01;
+            MemoryCard replay_card(data);
+            replay_card.power_on();
+            TraceReplayer replayer(replay_card);
+            WHEN("The traffic is replayed to it") {
+                bool matched = replayer.replay(records);
+                THEN("The first record the card responds differently to is reported") {
+                    CHECK_FALSE(matched);
+                    REQUIRE(replayer.result().diverged);
+                    // 140 bytes per Sector read, with Sector data starting at byte 10
+                    std::size_t expected_index = 2u * 140u + 10u + 44u;
+                    CHECK(replayer.result().divergence == expected_index);
+                    CHECK(replayer.result().expected == records[expected_index]);
+                    CHECK(*replayer.result().actual.miso == (*records[expected_index].miso ^ 0x01));
+                }
+                AND_WHEN("More traffic is replayed to it") {
+                    std::uint64_t replayed = replayer.result().replayed;
+                    THEN("Nothing more is replayed") {
+                        CHECK_FALSE(replayer.replay(records));
+                        CHECK(replayer.result().replayed == replayed);
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,75 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_ALLOCATOR_CARD_STORAGE_HPP
+#define COM_SAXBOPHONE_WONDERCARD_ALLOCATOR_CARD_STORAGE_HPP
+
+#include <algorithm>
+#include <memory>
+#include <span>
+
+#include <wondercard/common.hpp>
+#include <wondercard/CardStorage.hpp>
+#include <wondercard/MemoryCard.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief CardStorage which keeps the card data in a buffer obtained from
+     * the given allocator
+     * @details Use this to place card data in a memory pool, arena or other
+     * memory managed by a custom allocator.
+     * @tparam Allocator A standard allocator type (it is rebound to Byte)
+     */
+    template <typename Allocator = std::allocator<Byte>>
+    class AllocatorCardStorage : public CardStorage {
+    public:
+        typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Byte> allocator_type;
+        typedef typename std::allocator_traits<allocator_type>::pointer pointer;
+
+        /**
+         * @brief Allocates the card data, which starts out as all zeroes
+         * @param allocator The allocator to get the memory from
+         */
+        explicit AllocatorCardStorage(const Allocator& allocator = Allocator())
+          : _allocator(allocator)
+          , _data(std::allocator_traits<allocator_type>::allocate(this->_allocator, MemoryCard::CARD_SIZE))
+          {
+            std::fill_n(std::to_address(this->_data), MemoryCard::CARD_SIZE, (Byte)0x00);
+        }
+
+        /**
+         * @brief Gives the card data back to the allocator
+         */
+        ~AllocatorCardStorage() override {
+            std::allocator_traits<allocator_type>::deallocate(this->_allocator, this->_data, MemoryCard::CARD_SIZE);
+        }
+
+        AllocatorCardStorage(const AllocatorCardStorage&) = delete;
+        AllocatorCardStorage& operator=(const AllocatorCardStorage&) = delete;
+
+        std::span<Byte> bytes() override {
+            return std::span<Byte>(std::to_address(this->_data), MemoryCard::CARD_SIZE);
+        }
+
+    private:
+        allocator_type _allocator;
+        pointer _data;
+    };
+}
+
+#endif // include guard
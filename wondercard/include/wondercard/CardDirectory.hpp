@@ -0,0 +1,223 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_CARD_DIRECTORY_HPP
+#define COM_SAXBOPHONE_WONDERCARD_CARD_DIRECTORY_HPP
+
+#include <algorithm>
+#include <array>
+#include <span>
+#include <string_view>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+#include <wondercard/CardObserver.hpp>
+#include <wondercard/MemoryCard.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief An index of the saves on a MemoryCard, kept up to date as the
+     * card is written to
+     * @details Block 0 of a card is its directory: Sectors 1 to 15 of it are
+     * the directory frames of Blocks 1 to 15, saying whether each Block is in
+     * use, which save it belongs to and which Block comes next in that save.
+     * These are parsed once, when the directory is created, and then again
+     * only for the frames which are written to, so looking up a save never
+     * needs to go through the frames again.
+     * @note The directory attaches itself to the card as its CardObserver,
+     * replacing any other, and detaches itself when destroyed. Changes made
+     * to the card data directly which aren't reported with
+     * MemoryCard::mark_dirty() need a call to refresh().
+     */
+    class CardDirectory : public CardObserver {
+    public:
+        static constexpr std::size_t FRAME_COUNT = 15u; /**< Number of directory frames, and of Blocks for saves */
+        static constexpr std::size_t NAME_SIZE = 20u; /**< Longest a save's name can be */
+        static constexpr std::uint16_t NO_NEXT_BLOCK = 0xFFFFu; /**< Next Block pointer of the last Block of a save */
+
+        /**
+         * @brief Whether a Block is in use, as stored at the start of its
+         * directory frame
+         */
+        enum class BlockState : std::uint32_t {
+            FIRST = 0x51,          /**< In use, first Block of a save */
+            MIDDLE = 0x52,         /**< In use, middle Block of a save */
+            LAST = 0x53,           /**< In use, last Block of a save */
+            FREE = 0xA0,           /**< Free, never used */
+            DELETED_FIRST = 0xA1,  /**< Free, was the first Block of a deleted save */
+            DELETED_MIDDLE = 0xA2, /**< Free, was a middle Block of a deleted save */
+            DELETED_LAST = 0xA3,   /**< Free, was the last Block of a deleted save */
+        };
+
+        /**
+         * @brief One save on the card
+         * @warning The views in here are only valid until the directory next
+         * changes.
+         */
+        struct Save {
+            std::string_view name; /**< File name, e.g. `BASLUS-00000SAVEDATA` */
+            std::uint32_t size; /**< Size in bytes, as given in its first frame */
+            std::span<const std::uint8_t> blocks; /**< The Blocks holding it, in order (`{1..15}`) */
+
+            /**
+             * @returns The product code part of the name, e.g. `SLUS-00000`
+             */
+            std::string_view product_code() const {
+                return this->name.substr(std::min<std::size_t>(this->name.size(), 2u), 10u);
+            }
+        };
+
+        /**
+         * @brief A read-only view of the data of one save, straight out of the
+         * card's Blocks, in the order the save uses them
+         * @details Nothing is copied until copy_to() is called, and then only
+         * once, from the card into the caller's buffer.
+         * @warning A SaveView is only valid until the directory next changes.
+         */
+        class SaveView {
+        public:
+            /**
+             * @returns The number of Blocks in the save
+             */
+            std::size_t block_count() const {
+                return this->_blocks.size();
+            }
+
+            /**
+             * @returns The number of bytes in the save's Blocks
+             */
+            std::size_t size() const {
+                return this->_blocks.size() * MemoryCard::BLOCK_SIZE;
+            }
+
+            /**
+             * @returns The data of the given Block of the save
+             * @param index The index of the Block within the save
+             * (`{0..block_count() - 1}`)
+             */
+            std::span<const Byte, MemoryCard::BLOCK_SIZE> block(std::size_t index) const {
+                return this->_card.subspan(this->_blocks[index] * MemoryCard::BLOCK_SIZE).first<MemoryCard::BLOCK_SIZE>();
+            }
+
+            /**
+             * @brief Copies the save's data, one Block after another
+             * @param data Where to copy it to. Must be at least size() bytes.
+             * @throws std::invalid_argument if `data` is too small
+             */
+            void copy_to(std::span<Byte> data) const;
+
+        private:
+            friend class CardDirectory;
+
+            SaveView(std::span<const Byte, MemoryCard::CARD_SIZE> card, std::span<const std::uint8_t> blocks)
+              : _card(card)
+              , _blocks(blocks)
+              {}
+
+            std::span<const Byte, MemoryCard::CARD_SIZE> _card;
+            std::span<const std::uint8_t> _blocks;
+        };
+
+        /**
+         * @brief Parses the directory of the given card and attaches to it
+         * @param card The card to index. It must outlive the directory.
+         */
+        explicit CardDirectory(MemoryCard& card);
+
+        ~CardDirectory() override;
+
+        CardDirectory(const CardDirectory&) = delete;
+        CardDirectory& operator=(const CardDirectory&) = delete;
+
+        /**
+         * @returns The state of the given Block
+         * @param block The index of the Block (`{1..15}`)
+         */
+        BlockState block_state(std::size_t block) const;
+
+        /**
+         * @returns All saves on the card, in the order of their first Blocks
+         */
+        std::span<const Save> saves() const;
+
+        /**
+         * @returns The save with the given name
+         * @returns `nullptr` if there is no such save
+         */
+        const Save* find(std::string_view name) const;
+
+        /**
+         * @returns A view of the data of the given save
+         * @param save One of the saves on this directory's card
+         */
+        SaveView export_save(const Save& save) const;
+
+        /**
+         * @brief Adds a new save to the card, in as many free Blocks as it
+         * needs
+         * @details The lowest-numbered free Blocks are used. Their data and
+         * directory frames are all written at once, then marked as dirty, and
+         * the directory is indexed again only once at the end.
+         * @param name The new save's file name (at most NAME_SIZE characters)
+         * @param data The new save's data. Must be a whole number of Blocks.
+         * @returns The new save
+         * @returns `nullptr` if there is already a save with the same name, or
+         * there aren't enough free Blocks for it, in which case the card is not
+         * changed
+         * @throws std::invalid_argument if `name` is empty or too long, or the
+         * size of `data` is not a whole number of Blocks between 1 and
+         * FRAME_COUNT
+         */
+        const Save* import_save(std::string_view name, std::span<const Byte> data);
+
+        /**
+         * @brief Parses every directory frame again
+         */
+        void refresh();
+
+        /**
+         * @brief Parses the directory frame written to, if it was one
+         */
+        void sector_written(std::size_t sector, std::span<const Byte> data) override;
+
+    private:
+        // what we need to know from a directory frame
+        struct Frame {
+            BlockState state;
+            std::uint32_t size;
+            std::uint16_t next; // zero-based Block index
+            std::array<char, NAME_SIZE> name;
+            std::uint8_t name_length;
+        };
+
+        void _parse_frame(std::size_t block, std::span<const Byte> data);
+
+        // works out the saves and their Blocks from the frames
+        void _index_saves();
+
+        MemoryCard& _card;
+        std::array<Frame, FRAME_COUNT + 1> _frames; // by Block, so the first is unused
+        std::array<Save, FRAME_COUNT> _saves;
+        std::size_t _save_count;
+        std::array<std::uint8_t, FRAME_COUNT> _save_blocks; // the Blocks of each save, one save after another
+    };
+}
+
+#endif // include guard
@@ -0,0 +1,119 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_CARD_IMAGE_HPP
+#define COM_SAXBOPHONE_WONDERCARD_CARD_IMAGE_HPP
+
+#include <filesystem>
+#include <istream>
+#include <ostream>
+#include <span>
+
+#include <cstddef>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief Reads and writes MemoryCard image files in the common formats
+     * @details Every format holds the card's data as-is, either on its own
+     * or after a header: the header is skipped when reading, so the data is
+     * read straight into the card without going through any other buffer.
+     */
+    struct CardImage {
+        /**
+         * @brief The formats of image file which can be read and written
+         */
+        enum class Format {
+            UNKNOWN, /**< Not a format which can be read */
+            RAW,     /**< Just the card data (`.mcr`, `.mcd`, `.mc`, `.ddf`, `.srm`) */
+            GME,     /**< DexDrive image, the card data after a 3904-byte header (`.gme`) */
+            VMP,     /**< PSP/PS3 virtual memory card, the card data after a 128-byte header (`.vmp`) */
+        };
+
+        static constexpr std::size_t SNIFF_SIZE = 16u; /**< Number of bytes from the start of a file which sniff() needs */
+        static constexpr std::size_t GME_HEADER_SIZE = 0xF40u; /**< Size of the header of a GME image */
+        static constexpr std::size_t VMP_HEADER_SIZE = 0x80u; /**< Size of the header of a VMP image */
+
+        /**
+         * @returns The size of the header which comes before the card data in
+         * the given format (zero for RAW)
+         */
+        static std::size_t header_size(Format format);
+
+        /**
+         * @returns The format of an image file, worked out from the bytes at
+         * the start of it
+         * @returns `Format::UNKNOWN` if they aren't recognised, which is the
+         * case for an unformatted card in a RAW image
+         * @param head The first bytes of the file. If fewer than SNIFF_SIZE,
+         * only the formats whose magic fits can be recognised.
+         */
+        static Format sniff(std::span<const Byte> head);
+
+        /**
+         * @returns The format usually stored in files with the extension of the
+         * given path (regardless of case)
+         * @returns `Format::UNKNOWN` if the extension isn't recognised
+         */
+        static Format from_extension(const std::filesystem::path& path);
+
+        /**
+         * @brief Reads an image file into the given card data
+         * @param input Stream to read from, which should be in binary mode
+         * @param[out] data Where to store the card data
+         * @param format The format to read. If `UNKNOWN`, it is sniffed from
+         * the start of the file. A RAW image is read even if it starts like
+         * a file of some other format, but only if asked for explicitly.
+         * @returns `true` if the image was read successfully
+         * @returns `false` if the format couldn't be recognised, the header
+         * didn't match the format, the file was too short or reading from the
+         * stream failed, in which case `data` may have been partly written
+         */
+        static bool read(std::istream& input, std::span<Byte, MemoryCard::CARD_SIZE> data, Format format = Format::UNKNOWN);
+
+        /**
+         * @brief Reads an image file into the given card
+         * @details All of the card's Sectors are marked as dirty afterwards.
+         * @see read(std::istream&, std::span<Byte, MemoryCard::CARD_SIZE>, Format)
+         */
+        static bool read(std::istream& input, MemoryCard& card, Format format = Format::UNKNOWN);
+
+        /**
+         * @brief Writes the given card data as an image file
+         * @param output Stream to write to, which should be in binary mode
+         * @param data The card data to write
+         * @param format The format to write
+         * @returns `true` if the image was written successfully
+         * @returns `false` if writing to the stream failed
+         * @throws std::invalid_argument if `format` is `UNKNOWN`
+         * @note VMP images are written with an empty signature. Emulators
+         * accept these, but a real PSP or PS3 will not.
+         */
+        static bool write(std::ostream& output, std::span<const Byte, MemoryCard::CARD_SIZE> data, Format format);
+
+        /**
+         * @brief Writes the data of the given card as an image file
+         * @see write(std::ostream&, std::span<const Byte, MemoryCard::CARD_SIZE>, Format)
+         */
+        static bool write(std::ostream& output, const MemoryCard& card, Format format);
+    };
+}
+
+#endif // include guard
@@ -0,0 +1,51 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_CARD_OBSERVER_HPP
+#define COM_SAXBOPHONE_WONDERCARD_CARD_OBSERVER_HPP
+
+#include <span>
+
+#include <cstddef>
+
+#include <wondercard/common.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief Interface for things which need to know when the data of a
+     * MemoryCard changes
+     * @see MemoryCard::set_observer()
+     */
+    class CardObserver {
+    public:
+        virtual ~CardObserver() = default;
+
+        /**
+         * @brief Called once a Sector of the card has been written to
+         * @details This is called when the last byte of data arrives for a
+         * Sector written by a write command, for each Sector written in
+         * direct-access mode, restored by MemoryCard::deserialize() or
+         * marked with MemoryCard::mark_dirty().
+         * @param sector The index of the Sector (`{0..1023}`)
+         * @param data The Sector's new data
+         */
+        virtual void sector_written(std::size_t sector, std::span<const Byte> data) = 0;
+    };
+}
+
+#endif // include guard
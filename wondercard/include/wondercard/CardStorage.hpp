@@ -0,0 +1,65 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_CARD_STORAGE_HPP
+#define COM_SAXBOPHONE_WONDERCARD_CARD_STORAGE_HPP
+
+#include <span>
+
+#include <cstddef>
+
+#include <wondercard/common.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief Interface for the memory which holds the data of a MemoryCard
+     * @details A MemoryCard takes ownership of its storage and accesses the
+     * data through the view returned by bytes() for as long as it exists, so
+     * implementations must keep that memory valid and at the same address
+     * for their entire lifetime.
+     */
+    class CardStorage {
+    public:
+        virtual ~CardStorage() = default;
+
+        /**
+         * @returns A view of the card data, which must be exactly
+         * MemoryCard::CARD_SIZE bytes long
+         */
+        virtual std::span<Byte> bytes() = 0;
+
+        /**
+         * @brief Flushes the card data to whatever backs the storage, if
+         * anything does
+         * @returns `true` if the data was flushed successfully or there is
+         * nothing to flush it to
+         * @returns `false` if flushing the data failed
+         */
+        virtual bool sync() { return true; }
+
+        /**
+         * @returns How many bytes of the card data are actually taking up
+         * memory right now
+         * @details Storage which keeps all of the card data in memory all of
+         * the time doesn't need to override this.
+         */
+        virtual std::size_t resident_size() { return this->bytes().size(); }
+    };
+}
+
+#endif // include guard
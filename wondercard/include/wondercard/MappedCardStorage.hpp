@@ -0,0 +1,78 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_MAPPED_CARD_STORAGE_HPP
+#define COM_SAXBOPHONE_WONDERCARD_MAPPED_CARD_STORAGE_HPP
+
+#include <filesystem>
+#include <span>
+
+#include <wondercard/common.hpp>
+#include <wondercard/CardStorage.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief CardStorage which memory-maps a raw card image file
+     * @details Card data is never copied into memory up-front. Reads and
+     * writes to the card (including those made through the protocol) go
+     * straight to the operating system's page cache for the file, from which
+     * they will be written back to the file in due course. Use sync() to
+     * force them to be written back immediately.
+     */
+    class MappedCardStorage : public CardStorage {
+    public:
+        /**
+         * @brief Maps the raw card image file at the given path
+         * @param path Path of the image file to map, which must be exactly
+         * MemoryCard::CARD_SIZE bytes long
+         * @param create If `true`, the file is created with all-zero data if
+         * it does not exist, or if it is empty
+         * @throws std::system_error if the file cannot be opened or mapped
+         * @throws std::invalid_argument if the file is the wrong size
+         */
+        explicit MappedCardStorage(const std::filesystem::path& path, bool create = false);
+
+        /**
+         * @brief Unmaps the file
+         * @note Any changes not yet written back are still written back to
+         * the file by the operating system after unmapping
+         */
+        ~MappedCardStorage() override;
+
+        MappedCardStorage(const MappedCardStorage&) = delete;
+        MappedCardStorage& operator=(const MappedCardStorage&) = delete;
+
+        std::span<Byte> bytes() override;
+
+        /**
+         * @brief Writes any changes to the card data back to the file and
+         * waits for them to reach the disk
+         * @returns `true` if the changes were written successfully
+         * @returns `false` if writing the changes failed
+         */
+        bool sync() override;
+
+    private:
+        Byte* _data; // start of the mapping
+#ifdef _WIN32
+        void* _file; // file HANDLE, kept to flush file buffers on sync
+#endif
+    };
+}
+
+#endif // include guard
@@ -19,16 +19,24 @@
 #define COM_SAXBOPHONE_WONDERCARD_MEMORY_CARD_HPP
 
 #include <array>
+#include <memory>
 #include <optional>
 #include <span>
+#include <utility>
 
 #include <cstddef>
 #include <cstdint>
 
 #include <wondercard/common.hpp>
+#include <wondercard/CardStorage.hpp>
+#include <wondercard/SectorBitmap.hpp>
 
 
 namespace com::saxbophone::wondercard {
+    class CardObserver;
+    class RewindJournal;
+    class SectorCache;
+
     /**
      * @brief Represents a virtual PS1 Memory Card
      */
@@ -39,6 +47,7 @@ namespace com::saxbophone::wondercard {
         static constexpr std::size_t SECTOR_SIZE = 128u; /**< Number of bytes in a Sector */
         static constexpr std::size_t BLOCK_SIZE = BLOCK_SECTOR_COUNT * SECTOR_SIZE; /**< Number of bytes in a Block */
         static constexpr std::size_t CARD_SIZE = CARD_BLOCK_COUNT * BLOCK_SIZE; /**< Number of bytes in a MemoryCard */
+        static constexpr std::size_t CARD_SECTOR_COUNT = CARD_BLOCK_COUNT * BLOCK_SECTOR_COUNT; /**< Number of Sectors on the card */
 
         /**
          * @brief A non-owning view of an entire save Block on the MemoryCard
@@ -50,6 +59,26 @@ namespace com::saxbophone::wondercard {
          */
         typedef std::span<Byte, SECTOR_SIZE> Sector;
 
+        /**
+         * @brief What to include in a snapshot made with serialize()
+         */
+        enum class SnapshotMode : Byte {
+            MACHINE_STATE,    /**< Only the power and protocol state */
+            FULL,             /**< Machine state and all of the card data */
+            DIRTY_SINCE_BASE, /**< Machine state and the Sectors written since the last base snapshot */
+        };
+
+        static constexpr std::size_t MACHINE_STATE_SIZE = 9u; /**< Size of a MACHINE_STATE snapshot */
+
+        /**
+         * @brief How much memory a MemoryCard is taking up
+         * @see memory_usage()
+         */
+        struct MemoryUsage {
+            std::size_t object_size; /**< Size of the MemoryCard object itself */
+            std::size_t data_size; /**< Bytes of card data taking up memory, as reported by its storage */
+        };
+
         /**
          * @brief Initialises card data to all zeroes
          * @warning Default card data may change in future versions of the software
@@ -60,7 +89,61 @@ namespace com::saxbophone::wondercard {
          * @brief Populates card data with that of the supplied span
          * @param data The data to initialise the card data with
          */
-        MemoryCard(std::span<Byte, MemoryCard::CARD_SIZE> data);
+        MemoryCard(std::span<const Byte, MemoryCard::CARD_SIZE> data);
+
+        /**
+         * @brief Uses the given storage to hold the card data
+         * @details The card data is whatever is already in the storage.
+         * @param storage The storage to take ownership of
+         * @throws std::invalid_argument if `storage` is null or its bytes()
+         * are not exactly CARD_SIZE long
+         */
+        explicit MemoryCard(std::unique_ptr<CardStorage> storage);
+
+        /**
+         * @brief Creates a MemoryCard with storage of the given type
+         * @details e.g. `MemoryCard::with_storage<SpanCardStorage>(buffer)`
+         * @tparam Storage The type of CardStorage to use
+         * @param args Arguments to construct the storage with
+         * @returns A MemoryCard which owns a new Storage
+         * @see MemoryCard(std::unique_ptr<CardStorage>)
+         */
+        template <typename Storage, typename... Args>
+        static MemoryCard with_storage(Args&&... args) {
+            return MemoryCard(std::make_unique<Storage>(std::forward<Args>(args)...));
+        }
+
+        /**
+         * @brief Takes over the card data and state of another MemoryCard
+         * @details The card data is not copied, so this is cheap regardless
+         * of the card size. The other card is left powered off and without
+         * any card data, and may only be assigned to or destroyed.
+         * @warning A card must not be moved while inserted into a slot
+         */
+        MemoryCard(MemoryCard&& other) noexcept;
+
+        /**
+         * @brief Takes over the card data and state of another MemoryCard
+         * @see MemoryCard(MemoryCard&&)
+         */
+        MemoryCard& operator=(MemoryCard&& other) noexcept;
+
+        // copying a whole card is expensive, so must be asked for with clone()
+        MemoryCard(const MemoryCard&) = delete;
+        MemoryCard& operator=(const MemoryCard&) = delete;
+
+        /**
+         * @returns A deep copy of this MemoryCard, with its own copy of the
+         * card data and the same power, protocol and dirty Sector state
+         * @note The copy always keeps its card data in memory, whatever kind
+         * of storage this card has, and has no journal or observer attached.
+         */
+        MemoryCard clone() const;
+
+        /**
+         * @returns Whether the card is powered on or not
+         */
+        bool powered_on() const;
 
         /**
          * @brief Simulates powering up the card, e.g. when inserted into slot
@@ -96,6 +179,27 @@ namespace com::saxbophone::wondercard {
             TriState& data
         );
 
+        /**
+         * @brief Sends a whole buffer of commands to the card in one call
+         * @details This is equivalent to calling send() once for each element
+         * of `mosi` in turn, and produces byte-for-byte identical output, but
+         * avoids the per-byte dispatch overhead for the data-carrying portions
+         * of read and write transactions.
+         * @param mosi Commands to send to the card, in order
+         * @param[out] miso Destination to store response data from the card in
+         * (elements for which the card sends no data are left untouched, as
+         * with send())
+         * @param[out] ack Destination to store whether the card ACKed each
+         * command in
+         * @returns The number of commands sent, which is the size of the
+         * smallest of the three spans
+         */
+        std::size_t transfer(
+            std::span<const TriState> mosi,
+            std::span<TriState> miso,
+            std::span<bool> ack
+        );
+
         /**
          * @returns The Block on this MemoryCard with the given index
          * @param index The index of the Block to retrieve (`{0..15}`)
@@ -111,96 +215,254 @@ namespace com::saxbophone::wondercard {
         Sector get_sector(std::size_t index);
 
         /**
-         * @brief Read-only flag indicating whether the card is powered on or not
+         * @returns The XOR of all the bytes of the given Sector data, which is
+         * the part of a read or write checksum contributed by the data
+         * @details This is worked out a machine word at a time rather than
+         * byte by byte.
          */
-        const bool& powered_on;
+        static Byte sector_parity(std::span<const Byte, SECTOR_SIZE> data);
 
         /**
-         * @brief writable accessor for the MemoryCard data bytes
+         * @brief Flushes the card data to whatever backs the card's storage
+         * @returns `true` if the data was flushed successfully, or the card's
+         * storage is not backed by anything
+         * @returns `false` if flushing the data failed
+         * @see CardStorage::sync()
          */
-        std::span<Byte, CARD_SIZE> bytes;
+        bool sync();
+
+        /**
+         * @returns How much memory this MemoryCard is taking up
+         * @see CardStorage::resident_size()
+         */
+        MemoryUsage memory_usage();
+
+        /**
+         * @returns The set of Sectors which have been written to since dirty
+         * Sectors were last collected with collect_dirty_sectors()
+         * @details Sectors written to by write commands are marked as dirty
+         * automatically, as soon as the first byte of data arrives for them.
+         * Data modified directly, through bytes(), get_block() or
+         * get_sector(), is not tracked, so it must be reported with
+         * mark_dirty().
+         */
+        const SectorBitmap& dirty_sectors() const;
+
+        /**
+         * @brief Marks the given Sector as dirty
+         * @details Use this to report changes made to card data directly.
+         * @param index The index of the Sector to mark (`{0..1023}`)
+         */
+        void mark_dirty(std::size_t index);
+
+        /**
+         * @brief Retrieves the set of dirty Sectors and clears it, in one step
+         * @returns The Sectors which have been written to since the last call
+         */
+        SectorBitmap collect_dirty_sectors();
+
+        /**
+         * @returns The number of bytes serialize() would write for the given
+         * mode, right now
+         */
+        std::size_t snapshot_size(SnapshotMode mode) const;
+
+        /**
+         * @brief Writes a snapshot of the card to the given buffer, for
+         * save-states
+         * @details Snapshots can be taken at any time, including part-way
+         * through a transaction. Taking a FULL or DIRTY_SINCE_BASE snapshot
+         * makes it the new base snapshot, so the next DIRTY_SINCE_BASE
+         * snapshot only has the Sectors written after it. Sectors changed
+         * directly must be reported with mark_dirty() to be included.
+         * Nothing is allocated on the heap.
+         * @param[out] buffer Destination for the snapshot, which must be at
+         * least snapshot_size() bytes long
+         * @param mode What to include in the snapshot
+         * @returns The number of bytes written
+         * @returns `0` if `buffer` is too small, in which case nothing is
+         * written
+         */
+        std::size_t serialize(std::span<Byte> buffer, SnapshotMode mode = SnapshotMode::MACHINE_STATE);
+
+        /**
+         * @brief Restores the card from a snapshot written by serialize()
+         * @details A DIRTY_SINCE_BASE snapshot only holds the Sectors which
+         * changed since its base, so it must be restored on top of a card
+         * which matches that base. Any Sectors restored are marked as dirty.
+         * Restoring a FULL or DIRTY_SINCE_BASE snapshot makes it the new base
+         * snapshot.
+         * @param buffer The snapshot to restore
+         * @returns `true` if the card has been restored
+         * @returns `false` if `buffer` does not hold a valid snapshot, in
+         * which case the card is unchanged
+         */
+        bool deserialize(std::span<const Byte> buffer);
+
+        /**
+         * @brief Attaches a journal which records the old contents of each
+         * Sector before it is written to, so the card can be rewound
+         * @param journal The journal to attach, or `nullptr` to detach the
+         * current one. It is not owned by the card, and must outlive it or
+         * be detached first.
+         * @see RewindJournal
+         */
+        void set_journal(RewindJournal* journal);
+
+        /**
+         * @brief Attaches an observer which is told whenever a Sector has been
+         * written to
+         * @param observer The observer to attach, or `nullptr` to detach the
+         * current one. It is not owned by the card, and must outlive it or be
+         * detached first.
+         * @see CardObserver
+         */
+        void set_observer(CardObserver* observer);
+
+        /**
+         * @returns writable accessor for the MemoryCard data bytes
+         */
+        std::span<Byte, CARD_SIZE> bytes();
+
+        /**
+         * @returns read-only accessor for the MemoryCard data bytes
+         */
+        std::span<const Byte, CARD_SIZE> bytes() const;
 
     private:
-        enum class State {
+        friend class MemoryCardSlot;
+        friend class RewindJournal;
+
+        /*
+         * All the states of the protocol state machine in one flat list, each
+         * command's states following on from one another in protocol order.
+         */
+        enum class State : std::uint8_t {
             IDLE,                   /**< Not currently in a communication transaction */
             AWAITING_COMMAND,       /**< Which Memory Card Command mode? */
-            READ_DATA_COMMAND,      /**< Reading Memory Card Mode */
-            WRITE_DATA_COMMAND,     /**< Writing Memory Card Mode */
-            GET_MEMCARD_ID_COMMAND, /**< Get Memory Card ID Mode */
-        };
-
-        enum class ReadState {
-            RECV_MEMCARD_ID_1,
-            RECV_MEMCARD_ID_2,
-            SEND_ADDRESS_MSB,
-            SEND_ADDRESS_LSB,
-            RECV_COMMAND_ACK_1,
-            RECV_COMMAND_ACK_2,
-            RECV_CONFIRM_ADDRESS_MSB,
-            RECV_CONFIRM_ADDRESS_LSB,
-            RECV_DATA_SECTOR,
-            RECV_CHECKSUM,
-            RECV_END_BYTE,
+            // Reading Memory Card Mode
+            READ_RECV_MEMCARD_ID_1,
+            READ_RECV_MEMCARD_ID_2,
+            READ_SEND_ADDRESS_MSB,
+            READ_SEND_ADDRESS_LSB,
+            READ_RECV_COMMAND_ACK_1,
+            READ_RECV_COMMAND_ACK_2,
+            READ_RECV_CONFIRM_ADDRESS_MSB,
+            READ_RECV_CONFIRM_ADDRESS_LSB,
+            READ_RECV_DATA_SECTOR,
+            READ_RECV_CHECKSUM,
+            READ_RECV_END_BYTE,
+            // Writing Memory Card Mode
+            WRITE_RECV_MEMCARD_ID_1,
+            WRITE_RECV_MEMCARD_ID_2,
+            WRITE_SEND_ADDRESS_MSB,
+            WRITE_SEND_ADDRESS_LSB,
+            WRITE_SEND_DATA_SECTOR,
+            WRITE_SEND_CHECKSUM,
+            WRITE_RECV_COMMAND_ACK_1,
+            WRITE_RECV_COMMAND_ACK_2,
+            WRITE_RECV_END_BYTE,
+            // Get Memory Card ID Mode
+            GET_ID_RECV_MEMCARD_ID_1,
+            GET_ID_RECV_MEMCARD_ID_2,
+            GET_ID_RECV_COMMAND_ACK_1,
+            GET_ID_RECV_COMMAND_ACK_2,
+            GET_ID_RECV_INFO_1,
+            GET_ID_RECV_INFO_2,
+            GET_ID_RECV_INFO_3,
+            GET_ID_RECV_INFO_4,
+            STATE_COUNT, // not a real state, just the number of them
         };
 
-        enum class WriteState {
-            RECV_MEMCARD_ID_1,
-            RECV_MEMCARD_ID_2,
-            SEND_ADDRESS_MSB,
-            SEND_ADDRESS_LSB,
-            SEND_DATA_SECTOR,
-            SEND_CHECKSUM,
-            RECV_COMMAND_ACK_1,
-            RECV_COMMAND_ACK_2,
-            RECV_END_BYTE,
+        /*
+         * What needs doing when a byte arrives in a given state. All states
+         * which reply with a fixed byte share RESPOND and are handled entirely
+         * from the transition table, the rest need some code.
+         */
+        enum class Action : std::uint8_t {
+            RESPOND,
+            DETECT_MEMCARD_COMMAND,
+            DECODE_COMMAND,
+            LATCH_ADDRESS_MSB,
+            LATCH_ADDRESS_LSB,
+            CONFIRM_ADDRESS_MSB,
+            CONFIRM_ADDRESS_LSB,
+            READ_DATA,
+            READ_CHECKSUM,
+            WRITE_DATA,
+            WRITE_CHECKSUM,
+            WRITE_STATUS,
         };
 
-        enum class GetIdState {
-            RECV_MEMCARD_ID_1,
-            RECV_MEMCARD_ID_2,
-            RECV_COMMAND_ACK_1,
-            RECV_COMMAND_ACK_2,
-            RECV_INFO_1,
-            RECV_INFO_2,
-            RECV_INFO_3,
-            RECV_INFO_4,
+        // one row of the transition table
+        struct Transition {
+            Action action;
+            Byte response; // reply byte (for RESPOND, else the default reply)
+            State next;    // state to move to after this one
+            bool ack;      // whether to ACK (for RESPOND only)
         };
 
-        union SubState {
-            ReadState read_state;
-            WriteState write_state;
-            GetIdState get_id_state;
-        };
+        typedef std::array<Transition, (std::size_t)State::STATE_COUNT> TransitionTable;
 
-        bool read_data_command(
+        // handles all states whose action is not RESPOND
+        bool step(
+            const Transition& transition,
             TriState command,
             TriState& data
         );
 
-        bool write_data_command(
-            TriState command,
-            TriState& data
-        );
+        /*
+         * these carry out an entire read/write sector transaction in one go,
+         * leaving the card in exactly the state the equivalent sequence of
+         * send() calls would have done. They return false without doing
+         * anything if the card is not powered on and idle.
+         */
+        bool direct_read_sector(std::size_t index, Sector data);
 
-        bool get_memcard_id_command(
-            TriState command,
-            TriState& data
-        );
+        bool direct_write_sector(std::size_t index, Sector data);
+
+        // bookkeeping for a valid sector that is about to be written to
+        void begin_sector_write(std::uint16_t address);
+
+        // tells the observer, if any, that a sector has been written to
+        void end_sector_write(std::uint16_t address);
+
+        // like get_sector(), but for the card's own use
+        Sector sector_data(std::uint16_t address);
+
+        // the valid sector a write transaction in progress has started writing to, if any
+        std::optional<std::uint16_t> sector_being_written() const;
+
+        // drops the given sectors from the cache of the slot the card is in, as they may change
+        void forget_cached_sectors(std::size_t first, std::size_t count);
 
         const static Byte _FLAG_INIT_VALUE;
+        const static Byte _FLAG_NEW_CARD; // FLAG bit set until the first successful write since power-on
         const static State _STARTING_STATE;
         const static std::uint16_t _LAST_SECTOR;
+        const static TransitionTable _TRANSITIONS;
+        const static Byte _SNAPSHOT_VERSION;
 
         bool _powered_on;
         Byte _flag;  // special FLAG value, a kind of status register on card
         State _state;        // state machine state
-        SubState _sub_state; // sub-machine state
         std::uint16_t _address; // sector of address to read/write
         std::uint8_t _byte_counter; // index for tracking how many bytes read/written
         Byte _checksum; // scratchpad value for calculating checksums
-        // raw card data bytes
-        std::array<Byte, CARD_SIZE> _bytes;
+        SectorBitmap _dirty; // sectors written since last collected
+        SectorBitmap _snapshot_dirty; // sectors written since the last base snapshot
+        // owner of the raw card data bytes, which are accessed through _data
+        std::unique_ptr<CardStorage> _storage;
+        Byte* _data; // start of the card data, which is owned by _storage
+        RewindJournal* _journal; // optional, not owned
+        CardObserver* _observer; // optional, not owned
+        std::weak_ptr<SectorCache> _slot_cache; // cache of the MemoryCardSlot the card is in, if any
     };
+
+    static_assert(
+        MemoryCard::CARD_SECTOR_COUNT == SectorBitmap::SECTOR_COUNT,
+        "SectorBitmap must hold exactly one bit per MemoryCard Sector"
+    );
 }
 
 #endif // include guard
@@ -0,0 +1,165 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_MEMORY_CARD_CONTROLLER_HPP
+#define COM_SAXBOPHONE_WONDERCARD_MEMORY_CARD_CONTROLLER_HPP
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief A MemoryCardController manages a number of MemoryCardSlots, each
+     * of which carries out its operations on a worker thread of its own.
+     * @details Operations on the same slot are carried out one at a time, in
+     * the order they were requested. Operations on different slots run
+     * concurrently. Every operation returns a `std::future` for its result.
+     * @warning A MemoryCard must only be inserted into one slot at a time,
+     * and must not be used by anything else while it is inserted.
+     */
+    class MemoryCardController {
+    public:
+        /**
+         * @brief Creates a controller with the given number of slots, and
+         * starts a worker thread for each slot
+         * @param slot_count The number of slots to create
+         */
+        explicit MemoryCardController(std::size_t slot_count);
+
+        /**
+         * @brief Waits for all requested operations to finish, then stops the
+         * worker threads
+         */
+        ~MemoryCardController();
+
+        MemoryCardController(const MemoryCardController&) = delete;
+        MemoryCardController& operator=(const MemoryCardController&) = delete;
+
+        /**
+         * @returns The number of slots managed by this controller
+         */
+        std::size_t slot_count() const;
+
+        /**
+         * @brief Calls the given function with the slot with the given index,
+         * on that slot's worker thread
+         * @details All the other operations are carried out with this.
+         * @param slot Index of the slot (`{0..slot_count() - 1}`)
+         * @param function Function to call, taking a `MemoryCardSlot&`
+         * @returns A future for the return value of the function
+         * @throws std::out_of_range if `slot` is not a valid slot index
+         */
+        template <typename Function>
+        std::future<std::invoke_result_t<Function, MemoryCardSlot&>> submit(std::size_t slot, Function function) {
+            typedef std::invoke_result_t<Function, MemoryCardSlot&> Result;
+            // std::function needs a copyable callable, so the task is shared
+            auto task = std::make_shared<std::packaged_task<Result(MemoryCardSlot&)>>(std::move(function));
+            std::future<Result> result = task->get_future();
+            this->_enqueue(slot, [task](MemoryCardSlot& card_slot) { (*task)(card_slot); });
+            return result;
+        }
+
+        /**
+         * @brief Inserts a MemoryCard into the given slot
+         * @see MemoryCardSlot::insert_card()
+         */
+        std::future<bool> insert_card(std::size_t slot, MemoryCard& card);
+
+        /**
+         * @brief Removes the MemoryCard from the given slot
+         * @see MemoryCardSlot::remove_card()
+         */
+        std::future<bool> remove_card(std::size_t slot);
+
+        /**
+         * @brief Reads the entire contents of the card in the given slot
+         * @warning `data` must remain valid until the operation has finished
+         * @see MemoryCardSlot::read_card()
+         */
+        std::future<MemoryCardSlot::Result> read_card(std::size_t slot, std::span<Byte, MemoryCard::CARD_SIZE> data, std::size_t start = 0);
+
+        /**
+         * @brief Writes the entire contents of the card in the given slot
+         * @warning `data` must remain valid until the operation has finished
+         * @see MemoryCardSlot::write_card()
+         */
+        std::future<MemoryCardSlot::Result> write_card(std::size_t slot, std::span<Byte, MemoryCard::CARD_SIZE> data, std::size_t start = 0);
+
+        /**
+         * @brief Writes only the Sectors of the card in the given slot which
+         * differ from the given base image
+         * @warning `data` and `base` must remain valid until the operation has
+         * finished
+         * @see MemoryCardSlot::write_card_delta()
+         */
+        std::future<MemoryCardSlot::Result> write_card_delta(
+            std::size_t slot,
+            std::span<Byte, MemoryCard::CARD_SIZE> data,
+            std::span<const Byte, MemoryCard::CARD_SIZE> base,
+            std::size_t start = 0
+        );
+
+        /**
+         * @brief Reads a Block of the card in the given slot
+         * @warning `data` must remain valid until the operation has finished
+         * @see MemoryCardSlot::read_block()
+         */
+        std::future<MemoryCardSlot::Result> read_block(std::size_t slot, std::size_t index, MemoryCard::Block data);
+
+        /**
+         * @brief Writes a Block of the card in the given slot
+         * @warning `data` must remain valid until the operation has finished
+         * @see MemoryCardSlot::write_block()
+         */
+        std::future<MemoryCardSlot::Result> write_block(std::size_t slot, std::size_t index, MemoryCard::Block data);
+
+        /**
+         * @brief Reads a Sector of the card in the given slot
+         * @warning `data` must remain valid until the operation has finished
+         * @see MemoryCardSlot::read_sector()
+         */
+        std::future<MemoryCardSlot::Result> read_sector(std::size_t slot, std::size_t index, MemoryCard::Sector data);
+
+        /**
+         * @brief Writes a Sector of the card in the given slot
+         * @warning `data` must remain valid until the operation has finished
+         * @see MemoryCardSlot::write_sector()
+         */
+        std::future<MemoryCardSlot::Result> write_sector(std::size_t slot, std::size_t index, MemoryCard::Sector data);
+
+    private:
+        struct Worker;
+
+        void _enqueue(std::size_t slot, std::function<void(MemoryCardSlot&)> task);
+
+        std::vector<std::unique_ptr<Worker>> _workers;
+    };
+}
+
+#endif // include guard
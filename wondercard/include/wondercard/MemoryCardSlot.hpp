@@ -18,6 +18,7 @@
 #ifndef COM_SAXBOPHONE_WONDERCARD_MEMORY_CARD_SLOT_HPP
 #define COM_SAXBOPHONE_WONDERCARD_MEMORY_CARD_SLOT_HPP
 
+#include <memory>
 #include <optional>
 #include <span>
 
@@ -26,6 +27,8 @@
 
 #include <wondercard/common.hpp>
 #include <wondercard/MemoryCard.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+#include <wondercard/SectorCache.hpp>
 
 
 namespace com::saxbophone::wondercard {
@@ -35,8 +38,67 @@ namespace com::saxbophone::wondercard {
      */
     class MemoryCardSlot {
     public:
+        /**
+         * @brief Why a read or write failed
+         */
+        enum class Error : std::uint8_t {
+            NONE,              /**< It didn't, it succeeded */
+            NO_CARD,           /**< There is no card inserted */
+            NO_ACK,            /**< The card didn't ACK a byte it should have */
+            BAD_RESPONSE,      /**< The card replied to a byte with something other than expected */
+            BAD_CHECKSUM,      /**< The card says the checksum of the Sector written was wrong (`0x4E`) */
+            BAD_SECTOR,        /**< The card says the Sector doesn't exist (`0xFF`) */
+            CHECKSUM_MISMATCH, /**< The checksum the card sent doesn't match the Sector data read */
+        };
+
+        /**
+         * @brief The outcome of a read or write
+         * @details Converts to `true` on success, so it can be checked just
+         * like a `bool`. On failure, it says which Sector failed and where,
+         * so that just that Sector can be tried again.
+         */
+        struct Result {
+            Error error;
+            /**
+             * @brief The Sector being read or written when it failed
+             * @details After a successful Block or whole-card operation, this
+             * is the Sector following the last one transferred.
+             */
+            std::uint16_t sector;
+            std::uint16_t byte;   /**< The byte of that Sector's transaction it failed at */
+
+            explicit operator bool() const {
+                return this->error == Error::NONE;
+            }
+
+            bool operator==(const Result& other) const = default;
+        };
+
+        /**
+         * @brief How well the Sector cache is doing
+         * @see set_cache_capacity()
+         */
+        struct CacheStats {
+            std::uint64_t hits;        /**< Sector reads answered from the cache */
+            std::uint64_t misses;      /**< Sector reads which had to go to the card */
+            std::uint64_t bytes_saved; /**< Protocol bytes not exchanged with the card thanks to hits */
+
+            /**
+             * @returns The fraction of Sector reads answered from the cache
+             */
+            double hit_ratio() const {
+                std::uint64_t reads = this->hits + this->misses;
+                return reads == 0 ? 0.0 : (double)this->hits / (double)reads;
+            }
+        };
+
         MemoryCardSlot();
 
+        MemoryCardSlot(const MemoryCardSlot&) = delete;
+        MemoryCardSlot& operator=(const MemoryCardSlot&) = delete;
+        MemoryCardSlot(MemoryCardSlot&&) = default;
+        MemoryCardSlot& operator=(MemoryCardSlot&&) = default;
+
         /**
          * @brief Sends the given command byte to the inserted MemoryCard
          * @returns `false` when there is no MemoryCard inserted
@@ -64,73 +126,189 @@ namespace com::saxbophone::wondercard {
          */
         bool remove_card();
 
+        /**
+         * @brief Enables or disables direct-access mode
+         * @details In direct-access mode, read_sector() and write_sector()
+         * (and therefore the Block and whole-card methods too) copy data
+         * straight to and from the inserted MemoryCard rather than stepping it
+         * through the protocol one byte at a time. The card is left in exactly
+         * the state the equivalent protocol transaction would have left it in,
+         * so direct and protocol transactions can be freely interleaved.
+         * @note Whenever the inserted card is in the middle of a transaction
+         * begun with send(), the protocol is used regardless of this setting.
+         * @param enabled Whether direct-access mode should be used
+         */
+        void set_direct_mode(bool enabled);
+
+        /**
+         * @returns Whether direct-access mode is enabled
+         */
+        bool direct_mode() const;
+
+        /**
+         * @brief Starts or stops recording every byte exchanged with the
+         * inserted card into the given trace
+         * @details This covers bytes sent with send() as well as those sent
+         * by the read and write methods. Nothing is recorded for transactions
+         * carried out in direct-access mode, as no bytes are exchanged.
+         * When no trace is set, the cost is a single pointer check per byte.
+         * @note Tracing can be left out of the library entirely at build
+         * time, by configuring with `-DENABLE_PROTOCOL_TRACE=OFF`, in which
+         * case nothing is ever recorded.
+         * @param trace Trace to record into, or `nullptr` to stop recording.
+         * It is not owned by the slot.
+         * @see trace_supported()
+         */
+        void set_trace(ProtocolTrace* trace);
+
+        /**
+         * @returns The trace being recorded into, if any
+         */
+        ProtocolTrace* trace() const;
+
+        /**
+         * @returns Whether the library was built with tracing support
+         */
+        static bool trace_supported();
+
+        /**
+         * @brief Sets how many Sectors read from or written to the inserted
+         * card are kept in a cache in the slot, so reading them again doesn't
+         * need to go to the card
+         * @details The least recently used Sector is thrown away when the
+         * cache is full. Writes update the cache as well as the card. The
+         * cache is emptied when a card is inserted or removed, when bytes are
+         * sent with send(), and when the card's FLAG shows it has been powered
+         * off and on since it was last written to.
+         * @details Sectors are also dropped from the cache whenever the card's
+         * data is changed by other means: through MemoryCard::bytes(),
+         * get_block() or get_sector(), when reported with
+         * MemoryCard::mark_dirty(), or when restored by deserialize().
+         * @warning Data changed later through a view kept from bytes(),
+         * get_block() or get_sector() must be reported with
+         * MemoryCard::mark_dirty() before it is next read through this slot.
+         * @note Setting the capacity empties the cache and resets its stats.
+         * @param sectors The most Sectors to cache, or `0` to disable caching
+         * (the default)
+         */
+        void set_cache_capacity(std::size_t sectors);
+
+        /**
+         * @returns The most Sectors that are cached, `0` if caching is disabled
+         */
+        std::size_t cache_capacity() const;
+
+        /**
+         * @returns How well the Sector cache has done since it was set up
+         */
+        CacheStats cache_stats() const;
+
         /**
          * @brief Reads the entire contents of the inserted card
-         * @returns true/false indicating read sucess/failure
+         * @details Sectors are read in order, stopping at the first one which
+         * fails. The Result of a failure gives that Sector, every Sector
+         * before it having been read successfully, so the read can be resumed
+         * from there by passing it as `start`.
+         * @returns Result indicating read success, or the first failure
          * @param[out] data destination to write read data to
-         * @warning Not Implemented
+         * @param start Sector to start reading from, skipping those before it
          */
-        bool read_card(std::span<Byte, MemoryCard::CARD_SIZE> data);
+        Result read_card(std::span<Byte, MemoryCard::CARD_SIZE> data, std::size_t start = 0);
 
         /**
          * @brief Writes data from the given span to the entire card
-         * @returns true/false indicating write sucess/failure
+         * @details Sectors are written in order, stopping at the first one
+         * which fails. The Result of a failure gives that Sector, every Sector
+         * before it having been written successfully, so the write can be
+         * resumed from there by passing it as `start`.
+         * @returns Result indicating write success, or the first failure
          * @param data Data to write to the card
+         * @param start Sector to start writing from, skipping those before it
          */
-        bool write_card(std::span<Byte, MemoryCard::CARD_SIZE> data);
+        Result write_card(std::span<Byte, MemoryCard::CARD_SIZE> data, std::size_t start = 0);
+
+        /**
+         * @brief Writes data from the given span to the entire card, sending
+         * only the Sectors which differ from those of the given base image
+         * @details This is much quicker than write_card() when only a few
+         * Sectors have changed since the card was last read or written. The
+         * base image must be what the card currently holds, otherwise
+         * Sectors which differ on the card but not in the base are left
+         * alone. Failures are reported and resumed from as for write_card().
+         * @returns Result indicating write success, or the first failure
+         * @param data Data to write to the card
+         * @param base What the card currently holds
+         * @param start Sector to start writing from, skipping those before it
+         */
+        Result write_card_delta(
+            std::span<Byte, MemoryCard::CARD_SIZE> data,
+            std::span<const Byte, MemoryCard::CARD_SIZE> base,
+            std::size_t start = 0
+        );
 
         /**
          * @brief Reads the specified block of the inserted card
-         * @returns true/false indicating read sucess/failure
+         * @returns Result indicating read success, or the first failure
          * @param index Block to read from
          * @param[out] data destination to write read data to
-         * @todo Change return type to an enum or introduce exception throwing
-         * so the variety of causes of failure can be determined by the caller.
          */
-        bool read_block(std::size_t index, MemoryCard::Block data);
+        Result read_block(std::size_t index, MemoryCard::Block data);
 
         /**
          * @brief Writes data from the given span to the specified block of the
          * inserted card.
-         * @returns true/false indicating write sucess/failure
+         * @returns Result indicating write success, or the first failure
          * @param index Block to write to
          * @param data Data to write to the block
          */
-        bool write_block(std::size_t index, MemoryCard::Block data);
+        Result write_block(std::size_t index, MemoryCard::Block data);
 
         /**
          * @brief Reads the specified sector of the inserted card
-         * @returns true/false indicating read sucess/failure
+         * @returns Result indicating read success/failure
          * @param index Sector to read from
          * @param[out] data destination to write read data to
-         * @todo Change return type to an enum or introduce exception throwing
-         * so the variety of causes of failure can be determined by the caller.
          */
-        bool read_sector(std::size_t index, MemoryCard::Sector data);
+        Result read_sector(std::size_t index, MemoryCard::Sector data);
 
         /**
          * @brief Writes data from the given span to the specified sector of
          * the inserted card.
-         * @returns true/false indicating write sucess/failure
+         * @returns Result indicating write success/failure
          * @param index Sector to write to
          * @param data Data to write to the sector
          */
-        bool write_sector(std::size_t index, MemoryCard::Sector data);
+        Result write_sector(std::size_t index, MemoryCard::Sector data);
 
     private:
-        template <std::size_t sector_index>
-        bool _read_block_sector(std::size_t block_sector, MemoryCard::Block data);
+        const static std::size_t _READ_SECTOR_LENGTH; // bytes exchanged to read a sector
+
+        // sends a byte to the inserted card, recording it if tracing
+        bool _exchange(TriState command, TriState& data);
+
+        // read_sector() and write_sector() without the cache
+        Result _read_sector(std::size_t index, MemoryCard::Sector data);
 
-        template <std::size_t sector_index>
-        bool _write_block_sector(std::size_t block_sector, MemoryCard::Block data);
+        Result _write_sector(std::size_t index, MemoryCard::Sector data);
 
-        template <std::size_t block_index>
-        bool _read_card_block(std::span<Byte, MemoryCard::CARD_SIZE> data);
+        // empties the cache if the FLAG shows the card is new since last seen
+        void _observe_flag(TriState flag);
+
+        /*
+         * read/write consecutive sectors, starting with the given one, to/from
+         * data (which holds a whole number of sectors), stopping at the first
+         * failure
+         */
+        Result _read_sectors(std::size_t first, std::span<Byte> data);
 
-        template <std::size_t block_index>
-        bool _write_card_block(std::span<Byte, MemoryCard::CARD_SIZE> data);
+        Result _write_sectors(std::size_t first, std::span<Byte> data);
 
         MemoryCard* _inserted_card;
+        bool _direct_mode; // bypass the protocol when reading/writing sectors
+        ProtocolTrace* _trace; // optional, not owned
+        std::shared_ptr<SectorCache> _cache; // optional, shared with the inserted card so it can report changes
+        CacheStats _cache_stats;
+        bool _card_new; // whether the FLAG last seen said the card hadn't been written to
     };
 }
 
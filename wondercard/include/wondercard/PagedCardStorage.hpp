@@ -0,0 +1,70 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_PAGED_CARD_STORAGE_HPP
+#define COM_SAXBOPHONE_WONDERCARD_PAGED_CARD_STORAGE_HPP
+
+#include <span>
+
+#include <cstddef>
+
+#include <wondercard/common.hpp>
+#include <wondercard/CardStorage.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief CardStorage which only takes up memory for the parts of the card
+     * data which have been written to
+     * @details The card data is reserved as anonymous virtual memory, which
+     * the operating system only backs with real memory a page at a time, the
+     * first time each page is written to. Until then, reading a page gives
+     * zeroes from a single page shared by the whole system. This makes cards
+     * which are mostly empty, such as freshly formatted ones, much cheaper
+     * to keep around than with the default storage.
+     */
+    class PagedCardStorage : public CardStorage {
+    public:
+        /**
+         * @brief Reserves the card data, which starts out as all zeroes
+         * @throws std::system_error if the memory cannot be reserved
+         */
+        PagedCardStorage();
+
+        /**
+         * @brief Releases the card data
+         */
+        ~PagedCardStorage() override;
+
+        PagedCardStorage(const PagedCardStorage&) = delete;
+        PagedCardStorage& operator=(const PagedCardStorage&) = delete;
+
+        std::span<Byte> bytes() override;
+
+        /**
+         * @returns How many bytes of the card data are in pages which have
+         * been written to, and so have real memory of their own
+         * @note This asks the operating system, so it is not cheap to call.
+         */
+        std::size_t resident_size() override;
+
+    private:
+        Byte* _data; // start of the reserved memory
+    };
+}
+
+#endif // include guard
@@ -0,0 +1,151 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_PROTOCOL_DECODER_HPP
+#define COM_SAXBOPHONE_WONDERCARD_PROTOCOL_DECODER_HPP
+
+#include <array>
+#include <span>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief Works out which Memory Card transactions took place from the
+     * bytes exchanged with a card, without needing the card itself
+     * @details Records are fed in one at a time, in the order they were
+     * exchanged, e.g. as drained from a ProtocolTrace. A transaction starts
+     * when the card ACKs a `0x81` and ends at the first byte it doesn't ACK,
+     * at which point an Event describing it is produced. Bytes not sent to a
+     * Memory Card (i.e. not ACKed) outside of a transaction are ignored.
+     * Nothing is allocated once the decoder has been constructed.
+     */
+    class ProtocolDecoder {
+    public:
+        /**
+         * @brief The kind of transaction an Event describes
+         */
+        enum class EventKind : std::uint8_t {
+            READ_SECTOR,     /**< Read Sector command (`0x52`) */
+            WRITE_SECTOR,    /**< Write Sector command (`0x57`) */
+            GET_ID,          /**< Get Memory Card ID command (`0x53`) */
+            UNKNOWN_COMMAND, /**< A command the card didn't recognise, so it stopped after the FLAG */
+            ABORTED,         /**< The card stopped ACKing part-way through a transaction */
+        };
+
+        /**
+         * @brief One transaction which took place
+         */
+        struct Event {
+            EventKind kind;
+            Byte command;        /**< The command byte which was sent */
+            Byte flag;           /**< The FLAG the card replied to the command byte with */
+            /**
+             * @brief The end byte of a READ_SECTOR or WRITE_SECTOR
+             * @details `0x47` = Good, `0x4E` = Bad Checksum, `0xFF` = Bad
+             * Sector. A read of a bad Sector ends early, with no end byte,
+             * and is given `0xFF` too.
+             */
+            Byte status;
+            /**
+             * @brief Whether the checksum of a READ_SECTOR or WRITE_SECTOR
+             * matched its address and data
+             */
+            bool checksum_valid;
+            std::uint16_t sector; /**< The address sent for a READ_SECTOR or WRITE_SECTOR */
+            std::uint16_t length; /**< Number of bytes in the transaction */
+            std::uint64_t start;  /**< Index of the first byte of the transaction among all those fed */
+
+            bool operator==(const Event& other) const = default;
+        };
+
+        ProtocolDecoder();
+
+        /**
+         * @brief Decodes the next byte exchanged with the card
+         * @param record The byte
+         * @param[out] event Where to store the Event, if this byte ended a
+         * transaction
+         * @returns `true` if this byte ended a transaction
+         * @returns `false` otherwise, in which case event is left alone
+         */
+        bool feed(const ProtocolTrace::Record& record, Event& event);
+
+        /**
+         * @brief Decodes the given bytes, in order
+         * @param records The bytes
+         * @param function Function to call with each Event produced, taking
+         * a `const Event&`
+         */
+        template <typename Function>
+        void decode(std::span<const ProtocolTrace::Record> records, Function function) {
+            Event event;
+            for (const ProtocolTrace::Record& record : records) {
+                if (this->feed(record, event)) {
+                    function((const Event&)event);
+                }
+            }
+        }
+
+        /**
+         * @returns The data of the Sector read or written by the last
+         * transaction
+         * @note This is only meaningful straight after an Event for a
+         * complete READ_SECTOR or WRITE_SECTOR, and is overwritten as soon
+         * as the next such transaction is fed.
+         */
+        std::span<const Byte, MemoryCard::SECTOR_SIZE> sector_data() const;
+
+        /**
+         * @brief Forgets any transaction in progress, e.g. after some bytes
+         * have been lost
+         */
+        void reset();
+
+    private:
+        // positions of the bytes of each transaction
+        const static std::uint16_t _READ_DATA_START;
+        const static std::uint16_t _READ_CHECKSUM;
+        const static std::uint16_t _READ_END;
+        const static std::uint16_t _READ_BAD_SECTOR_END;
+        const static std::uint16_t _WRITE_DATA_START;
+        const static std::uint16_t _WRITE_CHECKSUM;
+        const static std::uint16_t _WRITE_END;
+        const static std::uint16_t _GET_ID_END;
+
+        // fills in the Event for the transaction which has just ended
+        void _finish(std::uint16_t position, Byte last_response, Event& event);
+
+        std::uint64_t _offset; // index of the next byte to be fed
+        std::uint64_t _start;
+        std::uint16_t _position; // position of the next byte within the transaction, 0 = not in one
+        std::uint16_t _sector;
+        Byte _command;
+        Byte _flag;
+        Byte _checksum;
+        bool _checksum_valid;
+        std::array<Byte, MemoryCard::SECTOR_SIZE> _data;
+    };
+}
+
+#endif // include guard
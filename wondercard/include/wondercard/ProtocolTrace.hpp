@@ -0,0 +1,108 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_PROTOCOL_TRACE_HPP
+#define COM_SAXBOPHONE_WONDERCARD_PROTOCOL_TRACE_HPP
+
+#include <atomic>
+#include <memory>
+#include <span>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief A fixed-size, lock-free ring buffer of the bytes exchanged with
+     * a MemoryCard, for debugging
+     * @details One thread (the one using the MemoryCardSlot the trace is
+     * attached to) adds records, and one other thread may take them out
+     * with drain() at the same time, e.g. to write them to a file. When the
+     * buffer is full, new records are dropped rather than waiting for room,
+     * and counted by dropped().
+     * @see MemoryCardSlot::set_trace()
+     */
+    class ProtocolTrace {
+    public:
+        /**
+         * @brief One byte exchanged with the card
+         */
+        struct Record {
+            TriState mosi; /**< Command byte sent to the card */
+            TriState miso; /**< Data byte sent back by the card (High-Z if none) */
+            bool ack;      /**< Whether the card ACKed */
+
+            bool operator==(const Record& other) const = default;
+        };
+
+        /**
+         * @brief Allocates the buffer up-front
+         * @param capacity The most records to hold at once, which is rounded
+         * up to a power of two
+         */
+        explicit ProtocolTrace(std::size_t capacity);
+
+        ProtocolTrace(const ProtocolTrace&) = delete;
+        ProtocolTrace& operator=(const ProtocolTrace&) = delete;
+
+        /**
+         * @brief Adds a record to the end of the buffer
+         * @warning Only one thread may call this at a time
+         * @returns `true` if the record was added
+         * @returns `false` if the buffer was full, so it was dropped
+         */
+        bool push(const Record& record);
+
+        /**
+         * @brief Takes as many of the oldest records out of the buffer as
+         * will fit in the given span
+         * @warning Only one thread may call this at a time, but it may be a
+         * different one to that calling push()
+         * @param[out] records Destination to store the records in, in order
+         * @returns The number of records taken out
+         */
+        std::size_t drain(std::span<Record> records);
+
+        /**
+         * @returns The number of records in the buffer right now
+         */
+        std::size_t size() const;
+
+        /**
+         * @returns The most records the buffer can hold at once
+         */
+        std::size_t capacity() const;
+
+        /**
+         * @returns The number of records dropped because the buffer was full
+         */
+        std::uint64_t dropped() const;
+
+    private:
+        std::size_t _capacity; // always a power of two
+        std::unique_ptr<Record[]> _records;
+        // kept apart so the two threads don't fight over the same cache line
+        alignas(64) std::atomic<std::size_t> _head; // next record to write, only written by push()
+        alignas(64) std::atomic<std::size_t> _tail; // next record to read, only written by drain()
+        std::atomic<std::uint64_t> _dropped;
+    };
+}
+
+#endif // include guard
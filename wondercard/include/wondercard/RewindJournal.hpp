@@ -0,0 +1,142 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_REWIND_JOURNAL_HPP
+#define COM_SAXBOPHONE_WONDERCARD_REWIND_JOURNAL_HPP
+
+#include <array>
+#include <deque>
+#include <span>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/SectorBitmap.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief Records the old contents of Sectors as they are written to, so
+     * that a MemoryCard can be rewound to an earlier point in time
+     * @details Attach a journal to a card with MemoryCard::set_journal(),
+     * then call mark() at each point that might need rewinding to (such as
+     * every frame of an emulator). Only the first write to each Sector
+     * between one marker and the next is recorded, so the memory used grows
+     * with the number of Sectors actually written, not with the number of
+     * markers. The journal is a ring buffer: once full, the oldest entries
+     * are overwritten, and markers which relied on them can no longer be
+     * rewound to.
+     * @note Only writes made through the protocol are recorded. Changes made
+     * directly to the card data are not.
+     */
+    class RewindJournal {
+    public:
+        /**
+         * @brief Identifies a point in time which can be rewound to
+         */
+        typedef std::uint64_t Marker;
+
+        /**
+         * @brief Creates an empty journal
+         * @param sector_capacity The most Sector entries to keep at once.
+         * Memory for them is only allocated as they are recorded.
+         * @param marker_capacity The most markers to keep at once
+         */
+        explicit RewindJournal(std::size_t sector_capacity, std::size_t marker_capacity = 4096u);
+
+        /**
+         * @brief Marks the current point in time, so that the card can later
+         * be rewound to it
+         * @param card The card this journal is attached to
+         * @returns The marker to pass to rewind_to()
+         */
+        Marker mark(MemoryCard& card);
+
+        /**
+         * @brief Rewinds the card to the given marker, restoring both its
+         * data and its protocol state to what they were at the time
+         * @details Markers made after the given one are forgotten, but the
+         * given marker can still be rewound to again. Sectors restored are
+         * marked as dirty on the card.
+         * @param card The card this journal is attached to
+         * @param marker The marker to rewind to
+         * @returns `true` if the card has been rewound
+         * @returns `false` if the marker is unknown or too old to rewind to,
+         * in which case the card is unchanged
+         */
+        bool rewind_to(MemoryCard& card, Marker marker);
+
+        /**
+         * @returns Whether the card can still be rewound to the given marker
+         */
+        bool can_rewind_to(Marker marker) const;
+
+        /**
+         * @brief Forgets all entries and markers
+         */
+        void clear();
+
+        /**
+         * @returns The number of Sector entries currently kept
+         */
+        std::size_t size() const;
+
+        /**
+         * @returns Approximate number of bytes of memory used by the journal
+         */
+        std::size_t memory_usage() const;
+
+    private:
+        friend class MemoryCard;
+
+        struct Entry {
+            std::uint16_t sector;
+            std::array<Byte, MemoryCard::SECTOR_SIZE> old_data;
+        };
+
+        struct MarkerEntry {
+            Marker marker;
+            std::uint64_t position; // number of entries recorded when the marker was made
+            std::array<Byte, MemoryCard::MACHINE_STATE_SIZE> state;
+        };
+
+        // called by the card just before a Sector starts being written to
+        void record(std::size_t sector, std::span<const Byte, MemoryCard::SECTOR_SIZE> old_data);
+
+        // starts recording afresh for the marker just made or rewound to
+        void restart_recording(MemoryCard& card);
+
+        // index of the oldest entry still kept
+        std::uint64_t oldest_position() const;
+
+        // the entry for the given marker, or nullptr if there isn't one
+        const MarkerEntry* find(Marker marker) const;
+
+        std::size_t _sector_capacity;
+        std::size_t _marker_capacity;
+        std::vector<Entry> _entries; // ring buffer, entry n lives at n % _sector_capacity
+        std::uint64_t _position; // number of entries recorded so far
+        std::deque<MarkerEntry> _markers;
+        Marker _next_marker;
+        SectorBitmap _recorded; // sectors already recorded since the last marker
+    };
+}
+
+#endif // include guard
@@ -0,0 +1,112 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_SECTOR_BITMAP_HPP
+#define COM_SAXBOPHONE_WONDERCARD_SECTOR_BITMAP_HPP
+
+#include <array>
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief A set of Sectors of a MemoryCard, stored as one bit per Sector
+     */
+    class SectorBitmap {
+    public:
+        static constexpr std::size_t SECTOR_COUNT = 1024u; /**< Number of Sectors on a MemoryCard */
+
+        /**
+         * @brief Initialises the set to empty
+         */
+        SectorBitmap();
+
+        /**
+         * @brief Adds the given Sector to the set
+         * @param sector The index of the Sector to add (`{0..1023}`)
+         */
+        void set(std::size_t sector);
+
+        /**
+         * @brief Removes the given Sector from the set
+         * @param sector The index of the Sector to remove (`{0..1023}`)
+         */
+        void reset(std::size_t sector);
+
+        /**
+         * @returns Whether the given Sector is in the set
+         * @param sector The index of the Sector to check (`{0..1023}`)
+         */
+        bool test(std::size_t sector) const;
+
+        /**
+         * @brief Removes all Sectors from the set
+         */
+        void clear();
+
+        /**
+         * @returns Whether there are any Sectors in the set
+         */
+        bool any() const;
+
+        /**
+         * @returns The number of Sectors in the set
+         */
+        std::size_t count() const;
+
+        /**
+         * @returns The lowest Sector in the set which is not lower than the
+         * given one
+         * @returns `SECTOR_COUNT` if there is no such Sector
+         * @param sector The index of the Sector to start searching from
+         */
+        std::size_t find_next(std::size_t sector) const;
+
+        /**
+         * @brief Calls the given function with the index of each Sector in the
+         * set, in ascending order
+         * @param function Function to call, taking one `std::size_t` argument
+         */
+        template <typename Function>
+        void for_each(Function function) const {
+            for (
+                std::size_t sector = this->find_next(0);
+                sector < SectorBitmap::SECTOR_COUNT;
+                sector = this->find_next(sector + 1)
+            ) {
+                function(sector);
+            }
+        }
+
+        /**
+         * @brief Adds all Sectors in the other set to this one
+         */
+        SectorBitmap& operator|=(const SectorBitmap& other);
+
+        bool operator==(const SectorBitmap& other) const = default;
+
+    private:
+        static constexpr std::size_t _WORD_BITS = 64u;
+        static constexpr std::size_t _WORD_COUNT = SECTOR_COUNT / _WORD_BITS;
+
+        std::array<std::uint64_t, _WORD_COUNT> _words;
+    };
+}
+
+#endif // include guard
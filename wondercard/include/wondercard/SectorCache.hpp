@@ -0,0 +1,110 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_SECTOR_CACHE_HPP
+#define COM_SAXBOPHONE_WONDERCARD_SECTOR_CACHE_HPP
+
+#include <array>
+#include <span>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief A fixed number of copies of MemoryCard Sectors, from which the
+     * least recently used one is thrown away to make room for another
+     * @details All the room needed is allocated up-front, and every
+     * operation takes constant time.
+     * @see MemoryCardSlot::set_cache_capacity()
+     */
+    class SectorCache {
+    public:
+        /**
+         * @param capacity The most Sectors to hold at once
+         */
+        explicit SectorCache(std::size_t capacity);
+
+        /**
+         * @brief Looks up the given Sector, making it the most recently used
+         * @param sector The index of the Sector to look up (`{0..1023}`)
+         * @param[out] data Destination to copy the Sector's data to
+         * @returns `true` if it was found
+         * @returns `false` if it was not, in which case data is left alone
+         */
+        bool get(std::size_t sector, MemoryCard::Sector data);
+
+        /**
+         * @brief Adds or updates the given Sector, making it the most recently
+         * used and throwing away the least recently used one if full
+         * @param sector The index of the Sector (`{0..1023}`)
+         * @param data The Sector's data
+         */
+        void put(std::size_t sector, std::span<const Byte, MemoryCard::SECTOR_SIZE> data);
+
+        /**
+         * @brief Throws away the given Sector, if held
+         * @param sector The index of the Sector (`{0..1023}`)
+         */
+        void erase(std::size_t sector);
+
+        /**
+         * @brief Throws away all Sectors
+         */
+        void clear();
+
+        /**
+         * @returns The number of Sectors held
+         */
+        std::size_t size() const;
+
+        /**
+         * @returns The most Sectors that can be held at once
+         */
+        std::size_t capacity() const;
+
+    private:
+        const static std::uint16_t _NONE; // null entry index
+
+        struct Entry {
+            std::array<Byte, MemoryCard::SECTOR_SIZE> data;
+            std::uint16_t sector;
+            std::uint16_t previous; // next most recently used
+            std::uint16_t next;     // next least recently used, or next free
+        };
+
+        // takes the entry out of the recently-used list
+        void _unlink(std::uint16_t entry);
+
+        // puts the entry at the most recently used end of the list
+        void _push_front(std::uint16_t entry);
+
+        std::vector<Entry> _entries;
+        std::array<std::uint16_t, MemoryCard::CARD_SECTOR_COUNT> _index; // entry holding each sector
+        std::uint16_t _most_recent;
+        std::uint16_t _least_recent;
+        std::uint16_t _free; // list of unused entries
+        std::size_t _size;
+    };
+}
+
+#endif // include guard
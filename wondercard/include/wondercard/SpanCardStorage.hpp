@@ -0,0 +1,58 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_SPAN_CARD_STORAGE_HPP
+#define COM_SAXBOPHONE_WONDERCARD_SPAN_CARD_STORAGE_HPP
+
+#include <span>
+
+#include <wondercard/common.hpp>
+#include <wondercard/CardStorage.hpp>
+#include <wondercard/MemoryCard.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief CardStorage which uses memory owned by someone else
+     * @details This lets a MemoryCard work directly on a buffer which already
+     * exists, such as part of an emulator save-state or a shared-memory
+     * segment, without copying it. Changes to the card data show up in the
+     * buffer straight away, and changes made to the buffer are sent by the
+     * card the next time it is read.
+     * @note The card isn't told about changes made to the buffer by its
+     * owner, so every Sector changed that way must be reported with
+     * MemoryCard::mark_dirty() for it to be tracked as dirty, passed on to
+     * a CardObserver and dropped from the Sector cache of a MemoryCardSlot.
+     * @warning The buffer must stay valid for as long as the MemoryCard
+     * using it exists.
+     */
+    class SpanCardStorage : public CardStorage {
+    public:
+        /**
+         * @brief Uses the given buffer for the card data, as it is
+         * @param data The buffer to use
+         */
+        explicit SpanCardStorage(std::span<Byte, MemoryCard::CARD_SIZE> data);
+
+        std::span<Byte> bytes() override;
+
+    private:
+        std::span<Byte, MemoryCard::CARD_SIZE> _data;
+    };
+}
+
+#endif // include guard
@@ -0,0 +1,109 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_TRACE_FILE_HPP
+#define COM_SAXBOPHONE_WONDERCARD_TRACE_FILE_HPP
+
+#include <array>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <vector>
+
+#include <cstddef>
+
+#include <wondercard/common.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief The compact on-disk format for recorded protocol traffic
+     * @details A trace file starts with the 8-byte MAGIC, followed by one
+     * 3-byte entry per ProtocolTrace::Record: a flags byte, then the MOSI
+     * byte, then the MISO byte. In the flags byte, bit 0 is set if MOSI was
+     * driven, bit 1 if MISO was driven and bit 2 if the card ACKed. Bytes
+     * which were not driven are stored as zero.
+     */
+    struct TraceFile {
+        static constexpr std::array<char, 8> MAGIC = {'W', 'C', 'T', 'R', 'A', 'C', 'E', '\x01'}; /**< Identifies a trace file */
+        static constexpr std::size_t RECORD_SIZE = 3u; /**< Size of each record in a trace file */
+    };
+
+    /**
+     * @brief Writes records to a trace file
+     * @see TraceFile
+     */
+    class TraceWriter {
+    public:
+        /**
+         * @brief Starts a new trace file, writing its header to the stream
+         * @param output Stream to write to, which should be in binary mode
+         */
+        explicit TraceWriter(std::ostream& output);
+
+        /**
+         * @brief Appends the given records to the file
+         * @returns `true` if they were written successfully
+         * @returns `false` if writing to the stream failed
+         */
+        bool write(std::span<const ProtocolTrace::Record> records);
+
+    private:
+        std::ostream& _output;
+        std::vector<char> _buffer; // encoded records waiting to be written
+    };
+
+    /**
+     * @brief Reads records back from a trace file, a chunk at a time
+     * @see TraceFile
+     */
+    class TraceReader {
+    public:
+        /**
+         * @brief Starts reading a trace file, checking its header
+         * @param input Stream to read from, which should be in binary mode
+         */
+        explicit TraceReader(std::istream& input);
+
+        /**
+         * @returns `false` if the header was wrong, the file ended part-way
+         * through a record, or reading from the stream failed
+         */
+        bool valid() const;
+
+        /**
+         * @brief Reads as many records as will fit in the given span
+         * @param[out] records Destination to store the records in, in order
+         * @returns The number of records read, which is less than the size of
+         * `records` only at the end of the file, or if it is not valid()
+         */
+        std::size_t read(std::span<ProtocolTrace::Record> records);
+
+        /**
+         * @brief Reads all of the remaining records
+         */
+        std::vector<ProtocolTrace::Record> read_all();
+
+    private:
+        std::istream& _input;
+        std::vector<char> _buffer; // encoded records read but not yet decoded
+        bool _valid;
+    };
+}
+
+#endif // include guard
@@ -0,0 +1,90 @@
+/**
+ * @file
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * @author Joshua Saxby <joshua.a.saxby@gmail.com>
+ * @date 2021-04-28
+ *
+ * @copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * @copyright
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#ifndef COM_SAXBOPHONE_WONDERCARD_TRACE_REPLAYER_HPP
+#define COM_SAXBOPHONE_WONDERCARD_TRACE_REPLAYER_HPP
+
+#include <span>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+#include <wondercard/TraceFile.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    /**
+     * @brief Sends recorded protocol traffic to a MemoryCard as fast as it
+     * can, checking that the card responds just as it did when recorded
+     * @details The MOSI bytes are sent in batches with MemoryCard::transfer()
+     * and the responses compared against the recorded MISO and ACK. The card
+     * must be powered on and in the same state as the one the traffic was
+     * recorded from (e.g. restored with MemoryCard::deserialize()).
+     * Replaying can be done in pieces, by calling replay() repeatedly, and
+     * stops at the first record the card responds differently to.
+     */
+    class TraceReplayer {
+    public:
+        /**
+         * @brief Where replaying has got to
+         */
+        struct Result {
+            std::uint64_t replayed; /**< Number of records replayed so far */
+            bool diverged; /**< Whether the card responded differently to a record */
+            std::uint64_t divergence; /**< Index of the first record responded to differently, if diverged */
+            ProtocolTrace::Record expected; /**< That record, as recorded */
+            ProtocolTrace::Record actual; /**< That record, as the card responded during replay */
+        };
+
+        /**
+         * @param card The card to replay traffic to
+         */
+        explicit TraceReplayer(MemoryCard& card);
+
+        /**
+         * @brief Replays the given records, following on from any replayed
+         * before
+         * @returns `true` if the card responded to all of them as recorded
+         * @returns `false` if it diverged, now or before
+         * @note When the card diverges, it will have been sent some of the
+         * records after the divergence too.
+         */
+        bool replay(std::span<const ProtocolTrace::Record> records);
+
+        /**
+         * @brief Replays all of the records from the given trace file
+         * @returns `true` if the card responded to all of them as recorded
+         * and the whole file could be read
+         * @returns `false` otherwise
+         */
+        bool replay(TraceReader& reader);
+
+        /**
+         * @returns Where replaying has got to
+         */
+        const Result& result() const;
+
+    private:
+        MemoryCard& _card;
+        Result _result;
+    };
+}
+
+#endif // include guard
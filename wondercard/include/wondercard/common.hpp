@@ -18,14 +18,107 @@
 #ifndef COM_SAXBOPHONE_WONDERCARD_COMMON_HPP
 #define COM_SAXBOPHONE_WONDERCARD_COMMON_HPP
 
+#include <concepts>
 #include <optional>
+#include <type_traits>
 
 #include <cstdint>
 
 
 namespace com::saxbophone::wondercard {
     typedef std::uint8_t Byte; /**< An 8-bit unsigned byte as used by the protocol code */
-    typedef std::optional<Byte> TriState; /**< A Tri-State Byte which uses `std::nullopt` to represent High-Z state */
+
+    /**
+     * @brief A Tri-State Byte, which is either a driven Byte value or in the
+     * High-Z state (represented by `std::nullopt`)
+     * @details This has the same semantics and conversions as
+     * `std::optional<Byte>`, but is packed into a single `std::uint16_t`:
+     * the value lives in the low 8 bits and bit 8 is set when it is driven.
+     * High-Z is always stored as all-zero bits, so a zero-initialised buffer
+     * of TriStates is all High-Z, and two TriStates are equal exactly when
+     * their bits are equal. This means spans of them can be copied and
+     * compared with plain loads.
+     */
+    class TriState {
+    public:
+        /**
+         * @brief Initialises to High-Z
+         */
+        constexpr TriState() : _bits(0) {}
+
+        /**
+         * @brief Initialises to High-Z
+         */
+        constexpr TriState(std::nullopt_t) : _bits(0) {}
+
+        /**
+         * @brief Initialises to the given driven value
+         * @details Integers of other types are converted to Byte, as they
+         * would be when assigned to a `std::optional<Byte>`.
+         */
+        template <std::integral T>
+        constexpr TriState(T value) : _bits((std::uint16_t)(TriState::_DRIVEN | (Byte)value)) {}
+
+        /**
+         * @returns Whether this TriState is driven (not High-Z)
+         */
+        constexpr bool has_value() const {
+            return this->_bits & TriState::_DRIVEN;
+        }
+
+        /**
+         * @returns Whether this TriState is driven (not High-Z)
+         */
+        constexpr explicit operator bool() const {
+            return this->has_value();
+        }
+
+        /**
+         * @returns The driven value
+         * @throws std::bad_optional_access if this TriState is High-Z
+         */
+        constexpr Byte value() const {
+            if (not this->has_value()) {
+                throw std::bad_optional_access();
+            }
+            return (Byte)this->_bits;
+        }
+
+        /**
+         * @returns The driven value, or `default_value` if this TriState is
+         * High-Z
+         */
+        template <std::integral T>
+        constexpr Byte value_or(T default_value) const {
+            return this->has_value() ? (Byte)this->_bits : (Byte)default_value;
+        }
+
+        /**
+         * @returns The driven value
+         * @warning The result is unspecified if this TriState is High-Z
+         */
+        constexpr Byte operator*() const {
+            return (Byte)this->_bits;
+        }
+
+        /**
+         * @brief Puts this TriState into the High-Z state
+         */
+        constexpr void reset() {
+            this->_bits = 0;
+        }
+
+        constexpr bool operator==(const TriState& other) const = default;
+
+    private:
+        static constexpr std::uint16_t _DRIVEN = 0x0100;
+
+        std::uint16_t _bits;
+    };
+
+    static_assert(sizeof(TriState) == sizeof(std::uint16_t));
+    static_assert(std::is_trivially_copyable_v<TriState>);
+    static_assert(std::is_standard_layout_v<TriState>);
 }
 
 #endif // include guard
@@ -0,0 +1,228 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#include <algorithm>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+#include <wondercard/CardDirectory.hpp>
+#include <wondercard/MemoryCard.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    namespace {
+        // directory frame fields are little-endian
+        std::uint32_t read_u32(std::span<const Byte> data, std::size_t offset) {
+            return
+                (std::uint32_t)data[offset] |
+                (std::uint32_t)data[offset + 1] << 8 |
+                (std::uint32_t)data[offset + 2] << 16 |
+                (std::uint32_t)data[offset + 3] << 24;
+        }
+
+        std::uint16_t read_u16(std::span<const Byte> data, std::size_t offset) {
+            return (std::uint16_t)(data[offset] | data[offset + 1] << 8);
+        }
+
+        void write_u32(std::span<Byte> data, std::size_t offset, std::uint32_t value) {
+            for (std::size_t i = 0; i < 4; i++) {
+                data[offset + i] = (Byte)(value >> (8 * i));
+            }
+        }
+
+        void write_u16(std::span<Byte> data, std::size_t offset, std::uint16_t value) {
+            data[offset] = (Byte)value;
+            data[offset + 1] = (Byte)(value >> 8);
+        }
+
+        // where the fields are in a directory frame
+        constexpr std::size_t STATE_OFFSET = 0x00;
+        constexpr std::size_t SIZE_OFFSET = 0x04;
+        constexpr std::size_t NEXT_OFFSET = 0x08;
+        constexpr std::size_t NAME_OFFSET = 0x0A;
+        constexpr std::size_t CHECKSUM_OFFSET = MemoryCard::SECTOR_SIZE - 1;
+    }
+
+    void CardDirectory::SaveView::copy_to(std::span<Byte> data) const {
+        if (data.size() < this->size()) {
+            throw std::invalid_argument("Buffer is too small for the save");
+        }
+        for (std::size_t i = 0; i < this->block_count(); i++) {
+            auto block = this->block(i);
+            std::copy(block.begin(), block.end(), data.begin() + (std::ptrdiff_t)(i * MemoryCard::BLOCK_SIZE));
+        }
+    }
+
+    CardDirectory::CardDirectory(MemoryCard& card)
+      : _card(card)
+      , _frames{}
+      , _saves{}
+      , _save_count(0)
+      , _save_blocks{}
+      {
+        this->refresh();
+        this->_card.set_observer(this);
+    }
+
+    CardDirectory::~CardDirectory() {
+        this->_card.set_observer(nullptr);
+    }
+
+    CardDirectory::BlockState CardDirectory::block_state(std::size_t block) const {
+        return this->_frames[block].state;
+    }
+
+    std::span<const CardDirectory::Save> CardDirectory::saves() const {
+        return std::span<const Save>(this->_saves.data(), this->_save_count);
+    }
+
+    const CardDirectory::Save* CardDirectory::find(std::string_view name) const {
+        for (const Save& save : this->saves()) {
+            if (save.name == name) {
+                return &save;
+            }
+        }
+        return nullptr;
+    }
+
+    CardDirectory::SaveView CardDirectory::export_save(const Save& save) const {
+        return SaveView(std::as_const(this->_card).bytes(), save.blocks);
+    }
+
+    const CardDirectory::Save* CardDirectory::import_save(std::string_view name, std::span<const Byte> data) {
+        if (name.empty() or name.size() > CardDirectory::NAME_SIZE) {
+            throw std::invalid_argument("Save name must be 1 to 20 characters");
+        }
+        std::size_t count = data.size() / MemoryCard::BLOCK_SIZE;
+        if (
+            data.size() % MemoryCard::BLOCK_SIZE != 0 or
+            count == 0 or count > CardDirectory::FRAME_COUNT
+        ) {
+            throw std::invalid_argument("Save data must be 1 to 15 whole Blocks");
+        }
+        if (this->find(name) != nullptr) {
+            return nullptr;
+        }
+        // the free states are all 0xAx
+        std::array<std::uint8_t, FRAME_COUNT> blocks;
+        std::size_t found = 0;
+        for (std::size_t block = 1; block <= CardDirectory::FRAME_COUNT and found < count; block++) {
+            if (((std::uint32_t)this->_frames[block].state & 0xF0u) == 0xA0u) {
+                blocks[found++] = (std::uint8_t)block;
+            }
+        }
+        if (found < count) {
+            return nullptr;
+        }
+        // every Sector is marked dirty below, so don't re-index for each frame
+        this->_card.set_observer(nullptr);
+        for (std::size_t i = 0; i < count; i++) {
+            std::size_t block = blocks[i];
+            auto source = data.subspan(i * MemoryCard::BLOCK_SIZE, MemoryCard::BLOCK_SIZE);
+            std::copy(source.begin(), source.end(), this->_card.get_block(block).begin());
+            // the frame of the first Block has the name and size of the save
+            MemoryCard::Sector frame = this->_card.get_sector(block);
+            std::fill(frame.begin(), frame.end(), (Byte)0x00);
+            BlockState state = i == 0 ? BlockState::FIRST : i + 1 == count ? BlockState::LAST : BlockState::MIDDLE;
+            write_u32(frame, STATE_OFFSET, (std::uint32_t)state);
+            write_u16(frame, NEXT_OFFSET, i + 1 == count ? CardDirectory::NO_NEXT_BLOCK : (std::uint16_t)(blocks[i + 1] - 1u));
+            if (i == 0) {
+                write_u32(frame, SIZE_OFFSET, (std::uint32_t)data.size());
+                std::copy(name.begin(), name.end(), frame.begin() + NAME_OFFSET);
+            }
+            Byte checksum = 0x00;
+            for (std::size_t b = 0; b < CHECKSUM_OFFSET; b++) {
+                checksum ^= frame[b];
+            }
+            frame[CHECKSUM_OFFSET] = checksum;
+            this->_parse_frame(block, frame);
+            for (std::size_t s = 0; s < MemoryCard::BLOCK_SECTOR_COUNT; s++) {
+                this->_card.mark_dirty(block * MemoryCard::BLOCK_SECTOR_COUNT + s);
+            }
+            this->_card.mark_dirty(block);
+        }
+        this->_card.set_observer(this);
+        this->_index_saves();
+        return this->find(name);
+    }
+
+    void CardDirectory::refresh() {
+        std::span<const Byte> bytes = std::as_const(this->_card).bytes();
+        for (std::size_t block = 1; block <= CardDirectory::FRAME_COUNT; block++) {
+            this->_parse_frame(block, bytes.subspan(block * MemoryCard::SECTOR_SIZE, MemoryCard::SECTOR_SIZE));
+        }
+        this->_index_saves();
+    }
+
+    void CardDirectory::sector_written(std::size_t sector, std::span<const Byte> data) {
+        // the directory frames are Sectors 1..15 of Block 0
+        if (sector >= 1 and sector <= CardDirectory::FRAME_COUNT) {
+            this->_parse_frame(sector, data);
+            this->_index_saves();
+        }
+    }
+
+    void CardDirectory::_parse_frame(std::size_t block, std::span<const Byte> data) {
+        Frame& frame = this->_frames[block];
+        frame.state = (BlockState)read_u32(data, STATE_OFFSET);
+        frame.size = read_u32(data, SIZE_OFFSET);
+        frame.next = read_u16(data, NEXT_OFFSET);
+        // the name ends at the first NUL, if it is shorter than the space for it
+        auto name = data.subspan(NAME_OFFSET, CardDirectory::NAME_SIZE);
+        auto end = std::find(name.begin(), name.end(), (Byte)0x00);
+        std::copy(name.begin(), end, frame.name.begin());
+        frame.name_length = (std::uint8_t)(end - name.begin());
+    }
+
+    void CardDirectory::_index_saves() {
+        this->_save_count = 0;
+        std::size_t used = 0;
+        // which Blocks already belong to a save, so broken chains can't loop or overlap
+        std::uint16_t claimed = 0;
+        for (std::size_t first = 1; first <= CardDirectory::FRAME_COUNT; first++) {
+            if (this->_frames[first].state != BlockState::FIRST) {
+                continue;
+            }
+            std::size_t start = used;
+            std::size_t block = first;
+            while (true) {
+                claimed |= (std::uint16_t)(1u << block);
+                this->_save_blocks[used++] = (std::uint8_t)block;
+                const Frame& frame = this->_frames[block];
+                if (frame.state == BlockState::LAST or frame.next == CardDirectory::NO_NEXT_BLOCK) {
+                    break;
+                }
+                std::size_t next = frame.next + 1u;
+                if (
+                    next > CardDirectory::FRAME_COUNT or
+                    ((unsigned)claimed >> next & 1u) or
+                    (this->_frames[next].state != BlockState::MIDDLE and this->_frames[next].state != BlockState::LAST)
+                ) {
+                    break;
+                }
+                block = next;
+            }
+            const Frame& frame = this->_frames[first];
+            this->_saves[this->_save_count++] = {
+                std::string_view(frame.name.data(), frame.name_length),
+                frame.size,
+                std::span<const std::uint8_t>(this->_save_blocks.data() + start, used - start),
+            };
+        }
+    }
+}
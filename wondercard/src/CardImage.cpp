@@ -0,0 +1,158 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <cctype>
+#include <cstddef>
+
+#include <wondercard/common.hpp>
+#include <wondercard/CardImage.hpp>
+#include <wondercard/MemoryCard.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    namespace {
+        // what each format starts with
+        constexpr std::string_view RAW_MAGIC = "MC";
+        constexpr std::string_view GME_MAGIC = "123-456-STD";
+        constexpr std::string_view VMP_MAGIC = {"\0PMV", 4};
+
+        bool starts_with(std::span<const Byte> data, std::string_view magic) {
+            return data.size() >= magic.size() and std::equal(magic.begin(), magic.end(), data.begin(), [](char m, Byte d) {
+                return (Byte)m == d;
+            });
+        }
+
+        // header fields written to GME images, as written by the DexDrive software
+        constexpr std::size_t GME_STATES_OFFSET = 0x16; // first byte of each directory frame
+        constexpr std::size_t GME_NEXTS_OFFSET = 0x26; // next Block pointer of each directory frame
+        constexpr std::size_t VMP_HEADER_SIZE_OFFSET = 0x04;
+    }
+
+    std::size_t CardImage::header_size(Format format) {
+        switch (format) {
+        case Format::GME:
+            return CardImage::GME_HEADER_SIZE;
+        case Format::VMP:
+            return CardImage::VMP_HEADER_SIZE;
+        default:
+            return 0;
+        }
+    }
+
+    CardImage::Format CardImage::sniff(std::span<const Byte> head) {
+        if (starts_with(head, GME_MAGIC)) {
+            return Format::GME;
+        } else if (starts_with(head, VMP_MAGIC)) {
+            return Format::VMP;
+        } else if (starts_with(head, RAW_MAGIC)) {
+            return Format::RAW;
+        }
+        return Format::UNKNOWN;
+    }
+
+    CardImage::Format CardImage::from_extension(const std::filesystem::path& path) {
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) {
+            return (char)std::tolower((unsigned char)c);
+        });
+        if (
+            extension == ".mcr" or extension == ".mcd" or extension == ".mc" or
+            extension == ".ddf" or extension == ".srm"
+        ) {
+            return Format::RAW;
+        } else if (extension == ".gme") {
+            return Format::GME;
+        } else if (extension == ".vmp") {
+            return Format::VMP;
+        }
+        return Format::UNKNOWN;
+    }
+
+    bool CardImage::read(std::istream& input, std::span<Byte, MemoryCard::CARD_SIZE> data, Format format) {
+        // the start of the file is needed to check the format, and may be the start of the card data too
+        std::array<Byte, CardImage::SNIFF_SIZE> head;
+        if (not input.read((char*)head.data(), (std::streamsize)head.size())) {
+            return false;
+        }
+        Format found = CardImage::sniff(head);
+        if (format == Format::UNKNOWN) {
+            format = found;
+        } else if (format != Format::RAW and found != format) {
+            // a RAW image asked for explicitly is allowed to look like anything, but headers must match
+            return false;
+        }
+        std::size_t header = CardImage::header_size(format);
+        if (format == Format::UNKNOWN) {
+            return false;
+        } else if (header == 0) {
+            std::copy(head.begin(), head.end(), data.begin());
+            std::span<Byte> rest = data.subspan(head.size());
+            return (bool)input.read((char*)rest.data(), (std::streamsize)rest.size());
+        } else {
+            // nothing is needed from the rest of the header
+            std::streamsize skip = (std::streamsize)(header - head.size());
+            if (not input.ignore(skip) or input.gcount() != skip) {
+                return false;
+            }
+            return (bool)input.read((char*)data.data(), (std::streamsize)data.size());
+        }
+    }
+
+    bool CardImage::read(std::istream& input, MemoryCard& card, Format format) {
+        bool success = CardImage::read(input, card.bytes(), format);
+        for (std::size_t sector = 0; sector < MemoryCard::CARD_SECTOR_COUNT; sector++) {
+            card.mark_dirty(sector);
+        }
+        return success;
+    }
+
+    bool CardImage::write(std::ostream& output, std::span<const Byte, MemoryCard::CARD_SIZE> data, Format format) {
+        if (format == Format::GME) {
+            std::array<Byte, CardImage::GME_HEADER_SIZE> header = {};
+            std::copy(GME_MAGIC.begin(), GME_MAGIC.end(), header.begin());
+            header[0x12] = 0x01;
+            header[0x14] = 0x01;
+            header[0x15] = 'M';
+            for (std::size_t block = 1; block < MemoryCard::CARD_BLOCK_COUNT; block++) {
+                std::span<const Byte> frame = data.subspan(block * MemoryCard::SECTOR_SIZE, MemoryCard::SECTOR_SIZE);
+                header[GME_STATES_OFFSET + block - 1] = frame[0x00];
+                header[GME_NEXTS_OFFSET + block - 1] = frame[0x08];
+            }
+            output.write((const char*)header.data(), (std::streamsize)header.size());
+        } else if (format == Format::VMP) {
+            // the signature is left empty
+            std::array<Byte, CardImage::VMP_HEADER_SIZE> header = {};
+            std::copy(VMP_MAGIC.begin(), VMP_MAGIC.end(), header.begin());
+            header[VMP_HEADER_SIZE_OFFSET] = (Byte)CardImage::VMP_HEADER_SIZE;
+            output.write((const char*)header.data(), (std::streamsize)header.size());
+        } else if (format != Format::RAW) {
+            throw std::invalid_argument("Can't write a card image of unknown format");
+        }
+        output.write((const char*)data.data(), (std::streamsize)data.size());
+        return (bool)output;
+    }
+
+    bool CardImage::write(std::ostream& output, const MemoryCard& card, Format format) {
+        return CardImage::write(output, card.bytes(), format);
+    }
+}
@@ -0,0 +1,140 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+
+#include <cerrno>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <wondercard/common.hpp>
+#include <wondercard/MappedCardStorage.hpp>
+#include <wondercard/MemoryCard.hpp>
+
+
+namespace com::saxbophone::wondercard {
+#ifdef _WIN32
+    MappedCardStorage::MappedCardStorage(const std::filesystem::path& path, bool create) {
+        HANDLE file = CreateFileW(
+            path.c_str(),
+            GENERIC_READ | GENERIC_WRITE,
+            FILE_SHARE_READ,
+            nullptr,
+            create ? OPEN_ALWAYS : OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL,
+            nullptr
+        );
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::system_error((int)GetLastError(), std::system_category(), "Can't open card image");
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            DWORD error = GetLastError();
+            CloseHandle(file);
+            throw std::system_error((int)error, std::system_category(), "Can't get card image size");
+        }
+        if (create and size.QuadPart == 0) {
+            // extending the file fills it with zeroes
+            size.QuadPart = MemoryCard::CARD_SIZE;
+            if (!SetFilePointerEx(file, size, nullptr, FILE_BEGIN) or !SetEndOfFile(file)) {
+                DWORD error = GetLastError();
+                CloseHandle(file);
+                throw std::system_error((int)error, std::system_category(), "Can't resize card image");
+            }
+        } else if (size.QuadPart != (LONGLONG)MemoryCard::CARD_SIZE) {
+            CloseHandle(file);
+            throw std::invalid_argument("Card image is not the size of a MemoryCard");
+        }
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+        if (mapping == nullptr) {
+            DWORD error = GetLastError();
+            CloseHandle(file);
+            throw std::system_error((int)error, std::system_category(), "Can't map card image");
+        }
+        void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, MemoryCard::CARD_SIZE);
+        DWORD error = GetLastError();
+        // the view keeps the mapping alive on its own
+        CloseHandle(mapping);
+        if (view == nullptr) {
+            CloseHandle(file);
+            throw std::system_error((int)error, std::system_category(), "Can't map card image");
+        }
+        this->_data = (Byte*)view;
+        this->_file = file;
+    }
+
+    MappedCardStorage::~MappedCardStorage() {
+        UnmapViewOfFile(this->_data);
+        CloseHandle(this->_file);
+    }
+
+    bool MappedCardStorage::sync() {
+        return FlushViewOfFile(this->_data, 0) and FlushFileBuffers(this->_file);
+    }
+#else
+    MappedCardStorage::MappedCardStorage(const std::filesystem::path& path, bool create) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0666);
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "Can't open card image");
+        }
+        struct stat status;
+        if (::fstat(fd, &status) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "Can't get card image size");
+        }
+        if (create and status.st_size == 0) {
+            // extending the file fills it with zeroes
+            if (::ftruncate(fd, (off_t)MemoryCard::CARD_SIZE) != 0) {
+                int error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), "Can't resize card image");
+            }
+        } else if (status.st_size != (off_t)MemoryCard::CARD_SIZE) {
+            ::close(fd);
+            throw std::invalid_argument("Card image is not the size of a MemoryCard");
+        }
+        void* mapping = ::mmap(nullptr, MemoryCard::CARD_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int error = errno;
+        // the mapping keeps the file open on its own
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            throw std::system_error(error, std::generic_category(), "Can't map card image");
+        }
+        this->_data = (Byte*)mapping;
+    }
+
+    MappedCardStorage::~MappedCardStorage() {
+        ::munmap(this->_data, MemoryCard::CARD_SIZE);
+    }
+
+    bool MappedCardStorage::sync() {
+        return ::msync(this->_data, MemoryCard::CARD_SIZE, MS_SYNC) == 0;
+    }
+#endif
+
+    std::span<Byte> MappedCardStorage::bytes() {
+        return std::span<Byte>(this->_data, MemoryCard::CARD_SIZE);
+    }
+}
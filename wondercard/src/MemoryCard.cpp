@@ -10,36 +10,137 @@
  *
  */
 
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <initializer_list>
+#include <iterator>
 #include <optional>
+#include <memory>
 #include <span>
+#include <stdexcept>
+#include <utility>
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 #include <wondercard/common.hpp>
+#include <wondercard/CardObserver.hpp>
+#include <wondercard/CardStorage.hpp>
 #include <wondercard/MemoryCard.hpp>
+#include <wondercard/RewindJournal.hpp>
+#include <wondercard/SectorBitmap.hpp>
+#include <wondercard/SectorCache.hpp>
 
 
 namespace com::saxbophone::wondercard {
+    namespace {
+        // default storage, which just keeps the card data in memory
+        class ArrayStorage : public CardStorage {
+        public:
+            std::span<Byte> bytes() override {
+                return this->_bytes;
+            }
+
+        private:
+            std::array<Byte, MemoryCard::CARD_SIZE> _bytes = {};
+        };
+
+        // validates the size of the given storage and returns the start of its data
+        Byte* storage_data(CardStorage* storage) {
+            if (storage == nullptr) {
+                throw std::invalid_argument("MemoryCard storage must not be null");
+            }
+            std::span<Byte> bytes = storage->bytes();
+            if (bytes.size() != MemoryCard::CARD_SIZE) {
+                throw std::invalid_argument("MemoryCard storage must be exactly CARD_SIZE bytes");
+            }
+            return bytes.data();
+        }
+    }
+
     MemoryCard::MemoryCard()
-      : powered_on(this->_powered_on)
-      , bytes(this->_bytes)
-      , _powered_on(false)
-      , _flag(MemoryCard::_FLAG_INIT_VALUE)
-      , _state(MemoryCard::_STARTING_STATE)
+      : MemoryCard(std::make_unique<ArrayStorage>())
       {}
 
     MemoryCard::MemoryCard(
-        std::span<Byte, MemoryCard::CARD_SIZE> data
+        std::span<const Byte, MemoryCard::CARD_SIZE> data
     )
       : MemoryCard()
       {
-        std::copy(data.begin(), data.end(), this->_bytes.begin());
+        std::copy(data.begin(), data.end(), this->_data);
+    }
+
+    MemoryCard::MemoryCard(std::unique_ptr<CardStorage> storage)
+      : _powered_on(false)
+      , _flag(MemoryCard::_FLAG_INIT_VALUE)
+      , _state(MemoryCard::_STARTING_STATE)
+      , _address(0x0000)
+      , _byte_counter(0x00)
+      , _checksum(0x00)
+      , _data(storage_data(storage.get()))
+      , _journal(nullptr)
+      , _observer(nullptr)
+      {
+        // only take ownership once the storage has been validated
+        this->_storage = std::move(storage);
+    }
+
+    MemoryCard::MemoryCard(MemoryCard&& other) noexcept
+      : _powered_on(std::exchange(other._powered_on, false))
+      , _flag(other._flag)
+      , _state(other._state)
+      , _address(other._address)
+      , _byte_counter(other._byte_counter)
+      , _checksum(other._checksum)
+      , _dirty(other._dirty)
+      , _snapshot_dirty(other._snapshot_dirty)
+      , _storage(std::move(other._storage))
+      , _data(std::exchange(other._data, nullptr))
+      , _journal(std::exchange(other._journal, nullptr))
+      , _observer(std::exchange(other._observer, nullptr))
+      , _slot_cache(std::move(other._slot_cache))
+      {}
+
+    MemoryCard& MemoryCard::operator=(MemoryCard&& other) noexcept {
+        if (this != &other) {
+            this->_powered_on = std::exchange(other._powered_on, false);
+            this->_flag = other._flag;
+            this->_state = other._state;
+            this->_address = other._address;
+            this->_byte_counter = other._byte_counter;
+            this->_checksum = other._checksum;
+            this->_dirty = other._dirty;
+            this->_snapshot_dirty = other._snapshot_dirty;
+            this->_storage = std::move(other._storage);
+            this->_data = std::exchange(other._data, nullptr);
+            this->_journal = std::exchange(other._journal, nullptr);
+            this->_observer = std::exchange(other._observer, nullptr);
+            this->_slot_cache = std::move(other._slot_cache);
+        }
+        return *this;
+    }
+
+    MemoryCard MemoryCard::clone() const {
+        MemoryCard copy(this->bytes());
+        copy._powered_on = this->_powered_on;
+        copy._flag = this->_flag;
+        copy._state = this->_state;
+        copy._address = this->_address;
+        copy._byte_counter = this->_byte_counter;
+        copy._checksum = this->_checksum;
+        copy._dirty = this->_dirty;
+        copy._snapshot_dirty = this->_snapshot_dirty;
+        return copy;
+    }
+
+    bool MemoryCard::powered_on() const {
+        return this->_powered_on;
     }
 
     bool MemoryCard::power_on() {
-        if (!this->powered_on) { // card is currently off, okay to power on
+        if (!this->_powered_on) { // card is currently off, okay to power on
             // set powered on and reset flag value to default
             this->_powered_on = true;
             this->_flag = MemoryCard::_FLAG_INIT_VALUE;
@@ -60,191 +161,379 @@ namespace com::saxbophone::wondercard {
         TriState& data
     ) {
         // don't do anything, including ACK, if card isn't powered on
-        if (!this->powered_on) {
+        if (!this->_powered_on) {
             return false;
-        } else {
-            switch (this->_state) {
-            case MemoryCard::State::IDLE:
-                if (command == 0x81) { // a Memory Card command
-                    this->_state = MemoryCard::State::AWAITING_COMMAND;
-                    return true;
-                } else { // ignore commands that aren't for Memory Cards
-                    return false;
+        }
+        const MemoryCard::Transition& transition = MemoryCard::_TRANSITIONS[(std::size_t)this->_state];
+        // most states just reply with a fixed byte and move on
+        if (transition.action == MemoryCard::Action::RESPOND) {
+            data = transition.response;
+            this->_state = transition.next;
+            return transition.ack;
+        }
+        // otherwise, there's some actual work to do
+        return this->step(transition, command, data);
+    }
+
+    std::size_t MemoryCard::transfer(
+        std::span<const TriState> mosi,
+        std::span<TriState> miso,
+        std::span<bool> ack
+    ) {
+        std::size_t count = std::min({mosi.size(), miso.size(), ack.size()});
+        std::size_t i = 0;
+        while (i < count) {
+            // sector data runs can be serviced in bulk, bypassing the dispatch
+            if (this->_powered_on and this->_state == MemoryCard::State::READ_RECV_DATA_SECTOR) {
+                std::size_t run = std::min(
+                    count - i,
+                    MemoryCard::SECTOR_SIZE - this->_byte_counter
+                );
+                auto sector = this->sector_data(this->_address).subspan(this->_byte_counter, run);
+                // XOR into a local, so the checksum isn't written back on every byte
+                Byte parity = 0x00;
+                for (std::size_t j = 0; j < run; j++) {
+                    miso[i + j] = sector[j];
+                    ack[i + j] = true;
+                    parity ^= sector[j];
                 }
-            case MemoryCard::State::AWAITING_COMMAND:
-                // always send FLAG in response
-                data = this->_flag;
-                switch (command.value_or(0x00)) { // decode memory card command
-                case 0x52:
-                    this->_state = MemoryCard::State::READ_DATA_COMMAND;
-                    this->_sub_state.read_state = MemoryCard::ReadState::RECV_MEMCARD_ID_1;
-                    break;
-                case 0x57:
-                    this->_state = MemoryCard::State::WRITE_DATA_COMMAND;
-                    this->_sub_state.write_state = MemoryCard::WriteState::RECV_MEMCARD_ID_1;
-                    break;
-                case 0x53:
-                    this->_state = MemoryCard::State::GET_MEMCARD_ID_COMMAND;
-                    this->_sub_state.get_id_state = MemoryCard::GetIdState::RECV_MEMCARD_ID_1;
-                    break;
-                default:
-                    this->_state = MemoryCard::State::IDLE;
-                    return false; // No ACK (last byte)
+                this->_checksum ^= parity;
+                this->_byte_counter += (std::uint8_t)run;
+                if (this->_byte_counter == MemoryCard::SECTOR_SIZE) {
+                    this->_state = MemoryCard::State::READ_RECV_CHECKSUM;
                 }
-                return true; // ACK
-            // otherwise, use sub-state-machines
-            case MemoryCard::State::READ_DATA_COMMAND:
-                return read_data_command(command, data);
-            case MemoryCard::State::WRITE_DATA_COMMAND:
-                return write_data_command(command, data);
-            case MemoryCard::State::GET_MEMCARD_ID_COMMAND:
-                return get_memcard_id_command(command, data);
-            default:
-                return false; // NACK
+                i += run;
+            } else if (this->_powered_on and this->_state == MemoryCard::State::WRITE_SEND_DATA_SECTOR) {
+                std::size_t run = std::min(
+                    count - i,
+                    MemoryCard::SECTOR_SIZE - this->_byte_counter
+                );
+                if (this->_byte_counter == 0 and this->_address != 0xFFFF) {
+                    this->begin_sector_write(this->_address);
+                }
+                for (std::size_t j = 0; j < run; j++) {
+                    // Z-state is converted to 0xFF, as in step()
+                    Byte write_byte = mosi[i + j].value_or(0xFF);
+                    if (this->_address != 0xFFFF) {
+                        this->sector_data(this->_address)[this->_byte_counter + j] = write_byte;
+                    }
+                    this->_checksum ^= write_byte;
+                    miso[i + j] = 0x00;
+                    ack[i + j] = true;
+                }
+                this->_byte_counter += (std::uint8_t)run;
+                if (this->_byte_counter == MemoryCard::SECTOR_SIZE) {
+                    if (this->_address != 0xFFFF) {
+                        this->end_sector_write(this->_address);
+                    }
+                    this->_state = MemoryCard::State::WRITE_SEND_CHECKSUM;
+                }
+                i += run;
+            } else {
+                // everything else goes through the regular byte-wise path
+                ack[i] = this->send(mosi[i], miso[i]);
+                i++;
             }
         }
+        return count;
     }
 
     MemoryCard::Block MemoryCard::get_block(std::size_t i) {
         // TODO: validate Block number
+        // caller may change the data, so the slot can't trust what it has cached
+        this->forget_cached_sectors(i * MemoryCard::BLOCK_SECTOR_COUNT, MemoryCard::BLOCK_SECTOR_COUNT);
         return MemoryCard::Block(
-            this->_bytes.begin() + i * MemoryCard::BLOCK_SIZE,
+            this->_data + i * MemoryCard::BLOCK_SIZE,
             MemoryCard::BLOCK_SIZE
         );
     }
 
     MemoryCard::Sector MemoryCard::get_sector(std::size_t i) {
         // TODO: validate Sector number
-        return MemoryCard::Sector(
-            this->_bytes.begin() + i * MemoryCard::SECTOR_SIZE,
-            MemoryCard::SECTOR_SIZE
-        );
+        // caller may change the data, so the slot can't trust what it has cached
+        this->forget_cached_sectors(i, 1);
+        return this->sector_data((std::uint16_t)i);
     }
 
-    bool MemoryCard::read_data_command(
-        TriState command,
-        TriState& data
-    ) {
-        switch (this->_sub_state.read_state) {
-        // for these two states, command is supposed to be 0x00 but what can we do if it's not?
-        case MemoryCard::ReadState::RECV_MEMCARD_ID_1:
-            data = 0x5A;
-            this->_sub_state.read_state = MemoryCard::ReadState::RECV_MEMCARD_ID_2;
-            break;
-        case MemoryCard::ReadState::RECV_MEMCARD_ID_2:
-            data = 0x5D;
-            this->_sub_state.read_state = MemoryCard::ReadState::SEND_ADDRESS_MSB;
-            break;
-        case MemoryCard::ReadState::SEND_ADDRESS_MSB:
-            this->_checksum = command.value_or(0xFF); // reset checksum
-            this->_address = (std::uint16_t)this->_checksum << 8;
-            data = 0x00;
-            this->_sub_state.read_state = MemoryCard::ReadState::SEND_ADDRESS_LSB;
-            break;
-        case MemoryCard::ReadState::SEND_ADDRESS_LSB:
-            this->_address |= command.value_or(0xFF);
-            this->_checksum ^= (Byte)(this->_address & 0x00FF);
-            // detect invalid sectors (out of bounds)
-            if (this->_address > MemoryCard::_LAST_SECTOR) {
-                this->_address = 0xFFFF; // poison value
+    Byte MemoryCard::sector_parity(std::span<const Byte, MemoryCard::SECTOR_SIZE> data) {
+        // XOR a word at a time, then fold the word down to a single byte
+        std::uint64_t word = 0;
+        for (std::size_t i = 0; i < MemoryCard::SECTOR_SIZE; i += sizeof(word)) {
+            std::uint64_t next;
+            std::memcpy(&next, data.data() + i, sizeof(next));
+            word ^= next;
+        }
+        word ^= word >> 32;
+        word ^= word >> 16;
+        word ^= word >> 8;
+        return (Byte)word;
+    }
+
+    bool MemoryCard::sync() {
+        return this->_storage->sync();
+    }
+
+    MemoryCard::MemoryUsage MemoryCard::memory_usage() {
+        return {sizeof(MemoryCard), this->_storage->resident_size()};
+    }
+
+    std::span<Byte, MemoryCard::CARD_SIZE> MemoryCard::bytes() {
+        // caller may change the data, so the slot can't trust what it has cached
+        this->forget_cached_sectors(0, MemoryCard::CARD_SECTOR_COUNT);
+        return std::span<Byte, MemoryCard::CARD_SIZE>(this->_data, MemoryCard::CARD_SIZE);
+    }
+
+    std::span<const Byte, MemoryCard::CARD_SIZE> MemoryCard::bytes() const {
+        return std::span<const Byte, MemoryCard::CARD_SIZE>(this->_data, MemoryCard::CARD_SIZE);
+    }
+
+    const SectorBitmap& MemoryCard::dirty_sectors() const {
+        return this->_dirty;
+    }
+
+    void MemoryCard::mark_dirty(std::size_t index) {
+        this->_dirty.set(index);
+        this->_snapshot_dirty.set(index);
+        this->end_sector_write((std::uint16_t)index);
+    }
+
+    SectorBitmap MemoryCard::collect_dirty_sectors() {
+        return std::exchange(this->_dirty, SectorBitmap());
+    }
+
+    /*
+     * Snapshot layout:
+     * - version, mode, powered on, flag, state, address MSB, address LSB,
+     *   byte counter, checksum (MACHINE_STATE_SIZE bytes)
+     * - FULL: all of the card data
+     * - DIRTY_SINCE_BASE: one bit per sector (LSB first) saying whether it
+     *   is included, then the data of each included sector in order
+     */
+    std::size_t MemoryCard::snapshot_size(SnapshotMode mode) const {
+        switch (mode) {
+        case MemoryCard::SnapshotMode::FULL:
+            return MemoryCard::MACHINE_STATE_SIZE + MemoryCard::CARD_SIZE;
+        case MemoryCard::SnapshotMode::DIRTY_SINCE_BASE:
+            return
+                MemoryCard::MACHINE_STATE_SIZE + MemoryCard::CARD_SECTOR_COUNT / 8 +
+                this->_snapshot_dirty.count() * MemoryCard::SECTOR_SIZE;
+        default:
+            return MemoryCard::MACHINE_STATE_SIZE;
+        }
+    }
+
+    std::size_t MemoryCard::serialize(std::span<Byte> buffer, SnapshotMode mode) {
+        std::size_t size = this->snapshot_size(mode);
+        if (buffer.size() < size) {
+            return 0;
+        }
+        Byte header[MemoryCard::MACHINE_STATE_SIZE] = {
+            MemoryCard::_SNAPSHOT_VERSION,
+            (Byte)mode,
+            this->_powered_on,
+            this->_flag,
+            (Byte)this->_state,
+            (Byte)(this->_address >> 8),
+            (Byte)(this->_address & 0x00FF),
+            this->_byte_counter,
+            this->_checksum,
+        };
+        Byte* output = std::copy(std::begin(header), std::end(header), buffer.data());
+        if (mode == MemoryCard::SnapshotMode::FULL) {
+            std::copy(this->_data, this->_data + MemoryCard::CARD_SIZE, output);
+        } else if (mode == MemoryCard::SnapshotMode::DIRTY_SINCE_BASE) {
+            Byte* included = output;
+            output = std::fill_n(included, MemoryCard::CARD_SECTOR_COUNT / 8, (Byte)0x00);
+            this->_snapshot_dirty.for_each([&](std::size_t sector) {
+                included[sector / 8] |= (Byte)(1u << (sector % 8));
+                output = std::copy_n(this->_data + sector * MemoryCard::SECTOR_SIZE, MemoryCard::SECTOR_SIZE, output);
+            });
+        }
+        // snapshots with data are the base for the next one
+        if (mode != MemoryCard::SnapshotMode::MACHINE_STATE) {
+            this->_snapshot_dirty.clear();
+        }
+        return size;
+    }
+
+    bool MemoryCard::deserialize(std::span<const Byte> buffer) {
+        // validate everything before changing anything
+        if (buffer.size() < MemoryCard::MACHINE_STATE_SIZE or buffer[0] != MemoryCard::_SNAPSHOT_VERSION) {
+            return false;
+        }
+        SnapshotMode mode = (SnapshotMode)buffer[1];
+        MemoryCard::State state = (MemoryCard::State)buffer[4];
+        std::uint16_t address = (std::uint16_t)(buffer[5] << 8 | buffer[6]);
+        // only states which can be reached by the protocol, as the card would crash in any others
+        if (
+            buffer[2] > 1 or
+            state >= MemoryCard::State::STATE_COUNT or
+            (address > MemoryCard::_LAST_SECTOR and address != 0xFFFF)
+        ) {
+            return false;
+        }
+        using enum MemoryCard::State;
+        // a read of a sector which doesn't exist is abandoned before any data is sent
+        bool reading_data = state == READ_RECV_DATA_SECTOR or state == READ_RECV_CHECKSUM or state == READ_RECV_END_BYTE;
+        if (address == 0xFFFF and reading_data) {
+            return false;
+        }
+        // the counter only reaches the end of a sector once its data has all been sent
+        bool sending_data = state == READ_RECV_DATA_SECTOR or state == WRITE_SEND_DATA_SECTOR;
+        if (buffer[7] > (sending_data ? MemoryCard::SECTOR_SIZE - 1 : MemoryCard::SECTOR_SIZE)) {
+            return false;
+        }
+        std::span<const Byte> data = buffer.subspan(MemoryCard::MACHINE_STATE_SIZE);
+        std::size_t sector_count = 0;
+        switch (mode) {
+        case MemoryCard::SnapshotMode::MACHINE_STATE:
+            if (not data.empty()) {
+                return false;
             }
-            data = 0x00;
-            this->_sub_state.read_state = MemoryCard::ReadState::RECV_COMMAND_ACK_1;
-            break;
-        // for these two states, command is supposed to be 0x00 but what can we do if it's not?
-        case MemoryCard::ReadState::RECV_COMMAND_ACK_1:
-            data = 0x5C;
-            this->_sub_state.read_state = MemoryCard::ReadState::RECV_COMMAND_ACK_2;
-            break;
-        case MemoryCard::ReadState::RECV_COMMAND_ACK_2:
-            data = 0x5D;
-            this->_sub_state.read_state = MemoryCard::ReadState::RECV_CONFIRM_ADDRESS_MSB;
             break;
-        case MemoryCard::ReadState::RECV_CONFIRM_ADDRESS_MSB:
-            data = (Byte)(this->_address >> 8);
-            this->_sub_state.read_state = MemoryCard::ReadState::RECV_CONFIRM_ADDRESS_LSB;
+        case MemoryCard::SnapshotMode::FULL:
+            if (data.size() != MemoryCard::CARD_SIZE) {
+                return false;
+            }
             break;
-        case MemoryCard::ReadState::RECV_CONFIRM_ADDRESS_LSB:
-            data = (Byte)(this->_address & 0x00FF);
-            // we'll only continue if sector address is not a poison value
-            if (this->_address == 0xFFFF) {
-                this->_state = MemoryCard::State::IDLE;
+        case MemoryCard::SnapshotMode::DIRTY_SINCE_BASE:
+            if (data.size() < MemoryCard::CARD_SECTOR_COUNT / 8) {
                 return false;
-            } else {
-                this->_sub_state.read_state = MemoryCard::ReadState::RECV_DATA_SECTOR;
-                this->_byte_counter = 0x00; // init counter
-                break;
             }
-        case MemoryCard::ReadState::RECV_DATA_SECTOR:
-            // reply with current byte from the correct sector
-            data = this->get_sector(this->_address)[this->_byte_counter];
-            // update checksum
-            this->_checksum ^= data.value();
-            this->_byte_counter++;
-            if (this->_byte_counter == 128u) {
-                this->_sub_state.read_state = MemoryCard::ReadState::RECV_CHECKSUM;
+            for (std::size_t i = 0; i < MemoryCard::CARD_SECTOR_COUNT / 8; i++) {
+                sector_count += (std::size_t)std::popcount(data[i]);
+            }
+            if (data.size() != MemoryCard::CARD_SECTOR_COUNT / 8 + sector_count * MemoryCard::SECTOR_SIZE) {
+                return false;
             }
             break;
-        case MemoryCard::ReadState::RECV_CHECKSUM:
-            data = this->_checksum;
-            this->_sub_state.read_state = MemoryCard::ReadState::RECV_END_BYTE;
-            break;
-        case MemoryCard::ReadState::RECV_END_BYTE:
-            data = 0x47; // should always be 0x47 for "Good read"
-            this->_state = MemoryCard::State::IDLE;
+        default:
             return false;
         }
+        this->_powered_on = buffer[2];
+        this->_flag = buffer[3];
+        this->_state = state;
+        this->_address = address;
+        this->_byte_counter = buffer[7];
+        this->_checksum = buffer[8];
+        if (mode == MemoryCard::SnapshotMode::FULL) {
+            std::copy(data.begin(), data.end(), this->_data);
+            for (std::size_t sector = 0; sector < MemoryCard::CARD_SECTOR_COUNT; sector++) {
+                this->_dirty.set(sector);
+                this->end_sector_write((std::uint16_t)sector);
+            }
+            this->_snapshot_dirty.clear();
+        } else if (mode == MemoryCard::SnapshotMode::DIRTY_SINCE_BASE) {
+            std::span<const Byte> sectors = data.subspan(MemoryCard::CARD_SECTOR_COUNT / 8);
+            for (std::size_t sector = 0; sector < MemoryCard::CARD_SECTOR_COUNT; sector++) {
+                if ((unsigned)data[sector / 8] >> (sector % 8) & 1u) {
+                    std::copy_n(sectors.data(), MemoryCard::SECTOR_SIZE, this->_data + sector * MemoryCard::SECTOR_SIZE);
+                    sectors = sectors.subspan(MemoryCard::SECTOR_SIZE);
+                    this->_dirty.set(sector);
+                    this->end_sector_write((std::uint16_t)sector);
+                }
+            }
+            this->_snapshot_dirty.clear();
+        }
         return true;
     }
 
-    bool MemoryCard::write_data_command(
+    bool MemoryCard::step(
+        const Transition& transition,
         TriState command,
         TriState& data
     ) {
-        switch (this->_sub_state.write_state) {
-        // for these two states, command is supposed to be 0x00 but what can we do if it's not?
-        case MemoryCard::WriteState::RECV_MEMCARD_ID_1:
-            data = 0x5A;
-            this->_sub_state.write_state = MemoryCard::WriteState::RECV_MEMCARD_ID_2;
-            break;
-        case MemoryCard::WriteState::RECV_MEMCARD_ID_2:
-            data = 0x5D;
-            this->_sub_state.write_state = MemoryCard::WriteState::SEND_ADDRESS_MSB;
-            break;
-        case MemoryCard::WriteState::SEND_ADDRESS_MSB:
+        switch (transition.action) {
+        case MemoryCard::Action::DETECT_MEMCARD_COMMAND:
+            if (command == 0x81) { // a Memory Card command
+                this->_state = transition.next;
+                return true;
+            } else { // ignore commands that aren't for Memory Cards
+                return false;
+            }
+        case MemoryCard::Action::DECODE_COMMAND:
+            // always send FLAG in response
+            data = this->_flag;
+            switch (command.value_or(0x00)) { // decode memory card command
+            case 0x52:
+                this->_state = MemoryCard::State::READ_RECV_MEMCARD_ID_1;
+                return true;
+            case 0x57:
+                this->_state = MemoryCard::State::WRITE_RECV_MEMCARD_ID_1;
+                return true;
+            case 0x53:
+                this->_state = MemoryCard::State::GET_ID_RECV_MEMCARD_ID_1;
+                return true;
+            default:
+                this->_state = MemoryCard::State::IDLE;
+                return false; // No ACK (last byte)
+            }
+        case MemoryCard::Action::LATCH_ADDRESS_MSB:
             this->_checksum = command.value_or(0xFF); // reset checksum
             this->_address = (std::uint16_t)this->_checksum << 8;
-            data = 0x00;
-            this->_sub_state.write_state = MemoryCard::WriteState::SEND_ADDRESS_LSB;
             break;
-        case MemoryCard::WriteState::SEND_ADDRESS_LSB:
+        case MemoryCard::Action::LATCH_ADDRESS_LSB:
             this->_address |= command.value_or(0xFF);
             this->_checksum ^= (Byte)(this->_address & 0x00FF);
             // detect invalid sectors (out of bounds)
             if (this->_address > MemoryCard::_LAST_SECTOR) {
                 this->_address = 0xFFFF; // poison value
             }
-            data = 0x00;
             this->_byte_counter = 0x00; // init counter
-            this->_sub_state.write_state = MemoryCard::WriteState::SEND_DATA_SECTOR;
             break;
-        case MemoryCard::WriteState::SEND_DATA_SECTOR:{
+        case MemoryCard::Action::CONFIRM_ADDRESS_MSB:
+            data = (Byte)(this->_address >> 8);
+            this->_state = transition.next;
+            return true;
+        case MemoryCard::Action::CONFIRM_ADDRESS_LSB:
+            data = (Byte)(this->_address & 0x00FF);
+            // we'll only continue if sector address is not a poison value
+            if (this->_address == 0xFFFF) {
+                this->_state = MemoryCard::State::IDLE;
+                return false;
+            }
+            this->_byte_counter = 0x00; // init counter
+            this->_state = transition.next;
+            return true;
+        case MemoryCard::Action::READ_DATA: {
+            // reply with current byte from the correct sector
+            Byte read_byte = this->sector_data(this->_address)[this->_byte_counter];
+            data = read_byte;
+            // update checksum
+            this->_checksum ^= read_byte;
+            this->_byte_counter++;
+            if (this->_byte_counter == MemoryCard::SECTOR_SIZE) {
+                this->_state = transition.next;
+            }
+            return true;
+        }
+        case MemoryCard::Action::READ_CHECKSUM:
+            data = this->_checksum;
+            this->_state = transition.next;
+            return true;
+        case MemoryCard::Action::WRITE_DATA: {
             // grab byte, converting Z-state to 0xFF if encountered (shouldn't, but...)
             Byte write_byte = command.value_or(0xFF);
             // so long as the sector address is valid, write the sector
             if (this->_address != 0xFFFF) {
-                this->get_sector(this->_address)[this->_byte_counter] = write_byte;
+                if (this->_byte_counter == 0) {
+                    this->begin_sector_write(this->_address);
+                }
+                this->sector_data(this->_address)[this->_byte_counter] = write_byte;
             }
             // update the checksum
             this->_checksum ^= write_byte;
             this->_byte_counter++;
-            data = 0x00;
-            if (this->_byte_counter == 128u) {
-                this->_sub_state.write_state = MemoryCard::WriteState::SEND_CHECKSUM;
+            data = transition.response;
+            if (this->_byte_counter == MemoryCard::SECTOR_SIZE) {
+                if (this->_address != 0xFFFF) {
+                    this->end_sector_write(this->_address);
+                }
+                this->_state = transition.next;
             }
-            break;
+            return true;
         }
-        case MemoryCard::WriteState::SEND_CHECKSUM:{
+        case MemoryCard::Action::WRITE_CHECKSUM: {
             // set to inverted calculated checksum if no value, to force a bad checksum in that case
             Byte sent_checksum = command.value_or(~this->_checksum);
             /*
@@ -253,19 +542,9 @@ namespace com::saxbophone::wondercard {
              * for brevity, store the result of comparison in the checksum
              */
             this->_checksum = sent_checksum == this->_checksum ? 0x00 : 0xFF;
-            data = 0x00;
-            this->_sub_state.write_state = MemoryCard::WriteState::RECV_COMMAND_ACK_1;
             break;
         }
-        case MemoryCard::WriteState::RECV_COMMAND_ACK_1:
-            data = 0x5C;
-            this->_sub_state.write_state = MemoryCard::WriteState::RECV_COMMAND_ACK_2;
-            break;
-        case MemoryCard::WriteState::RECV_COMMAND_ACK_2:
-            data = 0x5D;
-            this->_sub_state.write_state = MemoryCard::WriteState::RECV_END_BYTE;
-            break;
-        case MemoryCard::WriteState::RECV_END_BYTE:
+        case MemoryCard::Action::WRITE_STATUS:
             /*
              * status end byte:
              * 0x47 = Good, 0x4E = Bad Checksum, 0xFF = Bad Sector
@@ -276,58 +555,202 @@ namespace com::saxbophone::wondercard {
                 data = 0x4E;
             } else {                              // Good
                 data = 0x47;
+                // the card is no longer new once it has been written to
+                this->_flag &= (Byte)~MemoryCard::_FLAG_NEW_CARD;
             }
-            this->_state = MemoryCard::State::IDLE;
+            this->_state = transition.next;
             return false;
+        case MemoryCard::Action::RESPOND:
+            // handled by send(), but for completeness...
+            data = transition.response;
+            this->_state = transition.next;
+            return transition.ack;
         }
+        // the remaining actions all reply with the fixed response and ACK
+        data = transition.response;
+        this->_state = transition.next;
         return true;
     }
 
-    bool MemoryCard::get_memcard_id_command(
-        TriState,
-        TriState& data
-    ) {
-        // XXX: This function is hell please refactor it
-        switch (this->_sub_state.get_id_state) {
-        // for these two states, command is supposed to be 0x00 but what can we do if it's not?
-        case MemoryCard::GetIdState::RECV_MEMCARD_ID_1:
-            data = 0x5A;
-            this->_sub_state.get_id_state = MemoryCard::GetIdState::RECV_MEMCARD_ID_2;
-            break;
-        case MemoryCard::GetIdState::RECV_MEMCARD_ID_2:
-            data = 0x5D;
-            this->_sub_state.get_id_state = MemoryCard::GetIdState::RECV_COMMAND_ACK_1;
-            break;
-        // for these two states, command is supposed to be 0x00 but what can we do if it's not?
-        case MemoryCard::GetIdState::RECV_COMMAND_ACK_1:
-            data = 0x5C;
-            this->_sub_state.get_id_state = MemoryCard::GetIdState::RECV_COMMAND_ACK_2;
-            break;
-        case MemoryCard::GetIdState::RECV_COMMAND_ACK_2:
-            data = 0x5D;
-            this->_sub_state.get_id_state = MemoryCard::GetIdState::RECV_INFO_1;
-            break;
-        case MemoryCard::GetIdState::RECV_INFO_1:
-            data = 0x04;
-            this->_sub_state.get_id_state = MemoryCard::GetIdState::RECV_INFO_2;
-            break;
-        case MemoryCard::GetIdState::RECV_INFO_2:
-            data = 0x00;
-            this->_sub_state.get_id_state = MemoryCard::GetIdState::RECV_INFO_3;
-            break;
-        case MemoryCard::GetIdState::RECV_INFO_3:
-            data = 0x00;
-            this->_sub_state.get_id_state = MemoryCard::GetIdState::RECV_INFO_4;
-            break;
-        case MemoryCard::GetIdState::RECV_INFO_4:
-            data = 0x80;
-            this->_state = MemoryCard::State::IDLE;
+    bool MemoryCard::direct_read_sector(std::size_t index, Sector data) {
+        // only a card sitting idle would respond to a read transaction from the top
+        if (!this->_powered_on or this->_state != MemoryCard::State::IDLE) {
             return false;
         }
+        // sector number is sent as two bytes, of which only the low 10 bits survive
+        this->_address = (std::uint16_t)(index & MemoryCard::_LAST_SECTOR);
+        auto sector = this->sector_data(this->_address);
+        std::copy(sector.begin(), sector.end(), data.begin());
+        // the checksum is of the data as copied, worked out a word at a time
+        this->_checksum = (Byte)(this->_address >> 8) ^ (Byte)(this->_address & 0x00FF);
+        this->_checksum ^= MemoryCard::sector_parity(data);
+        this->_byte_counter = MemoryCard::SECTOR_SIZE;
+        // end of transaction: exactly where step() leaves things
         return true;
     }
 
+    bool MemoryCard::direct_write_sector(std::size_t index, Sector data) {
+        // only a card sitting idle would respond to a write transaction from the top
+        if (!this->_powered_on or this->_state != MemoryCard::State::IDLE) {
+            return false;
+        }
+        // sector number is sent as two bytes, of which only the low 10 bits survive
+        this->_address = (std::uint16_t)(index & MemoryCard::_LAST_SECTOR);
+        this->begin_sector_write(this->_address);
+        std::copy(data.begin(), data.end(), this->sector_data(this->_address).begin());
+        this->_byte_counter = MemoryCard::SECTOR_SIZE;
+        // checksum is always calculated correctly by the slot, so it validates
+        this->_checksum = 0x00;
+        this->_flag &= (Byte)~MemoryCard::_FLAG_NEW_CARD;
+        this->end_sector_write(this->_address);
+        return true;
+    }
+
+    void MemoryCard::set_journal(RewindJournal* journal) {
+        this->_journal = journal;
+    }
+
+    void MemoryCard::set_observer(CardObserver* observer) {
+        this->_observer = observer;
+    }
+
+    void MemoryCard::begin_sector_write(std::uint16_t address) {
+        // the journal needs the sector as it was before any of it changes
+        if (this->_journal != nullptr) {
+            this->_journal->record(address, this->sector_data(address));
+        }
+        this->_dirty.set(address);
+        this->_snapshot_dirty.set(address);
+        this->forget_cached_sectors(address, 1);
+    }
+
+    void MemoryCard::end_sector_write(std::uint16_t address) {
+        // covers sectors changed without a write command, e.g. reported with mark_dirty()
+        this->forget_cached_sectors(address, 1);
+        if (this->_observer != nullptr) {
+            this->_observer->sector_written(address, this->sector_data(address));
+        }
+    }
+
+    MemoryCard::Sector MemoryCard::sector_data(std::uint16_t address) {
+        return MemoryCard::Sector(
+            this->_data + address * MemoryCard::SECTOR_SIZE,
+            MemoryCard::SECTOR_SIZE
+        );
+    }
+
+    std::optional<std::uint16_t> MemoryCard::sector_being_written() const {
+        if (this->_address == 0xFFFF) {
+            return std::nullopt;
+        }
+        switch (this->_state) {
+        case MemoryCard::State::WRITE_SEND_DATA_SECTOR:
+            // the write only starts with the first byte of data
+            if (this->_byte_counter == 0) {
+                return std::nullopt;
+            }
+            return this->_address;
+        case MemoryCard::State::WRITE_SEND_CHECKSUM:
+        case MemoryCard::State::WRITE_RECV_COMMAND_ACK_1:
+        case MemoryCard::State::WRITE_RECV_COMMAND_ACK_2:
+        case MemoryCard::State::WRITE_RECV_END_BYTE:
+            return this->_address;
+        default:
+            return std::nullopt;
+        }
+    }
+
+    void MemoryCard::forget_cached_sectors(std::size_t first, std::size_t count) {
+        // the slot may have gone away without the card being removed from it
+        std::shared_ptr<SectorCache> cache = this->_slot_cache.lock();
+        if (cache == nullptr) {
+            return;
+        }
+        if (count == MemoryCard::CARD_SECTOR_COUNT) {
+            cache->clear();
+            return;
+        }
+        for (std::size_t sector = first; sector < first + count; sector++) {
+            cache->erase(sector);
+        }
+    }
+
     const Byte MemoryCard::_FLAG_INIT_VALUE = 0x08;
+    const Byte MemoryCard::_FLAG_NEW_CARD = 0x08;
     const MemoryCard::State MemoryCard::_STARTING_STATE = MemoryCard::State::IDLE;
     const std::uint16_t MemoryCard::_LAST_SECTOR = 0x03FF;
+    const Byte MemoryCard::_SNAPSHOT_VERSION = 0x01;
+    constinit const MemoryCard::TransitionTable MemoryCard::_TRANSITIONS = []() consteval {
+        using enum MemoryCard::State;
+        using enum MemoryCard::Action;
+        TransitionTable table = {};
+        // sets all table entries for a chain of states which follow on from one another
+        auto chain = [&table](
+            std::initializer_list<MemoryCard::State> states,
+            std::initializer_list<std::pair<MemoryCard::Action, Byte>> actions
+        ) {
+            auto state = states.begin();
+            for (auto [action, response] : actions) {
+                auto next = std::next(state);
+                bool last = next == states.end();
+                table[(std::size_t)*state] = {action, response, last ? IDLE : *next, not last};
+                state = next;
+            }
+        };
+        // responses which are the same for every command
+        constexpr Byte MEMCARD_ID_1 = 0x5A, MEMCARD_ID_2 = 0x5D;
+        constexpr Byte COMMAND_ACK_1 = 0x5C, COMMAND_ACK_2 = 0x5D;
+        // the ID info bytes sent in reply to a Get Memory Card ID command
+        constexpr std::array<Byte, 4> MEMCARD_INFO = {0x04, 0x00, 0x00, 0x80};
+        table[(std::size_t)IDLE] = {DETECT_MEMCARD_COMMAND, 0x00, AWAITING_COMMAND, true};
+        table[(std::size_t)AWAITING_COMMAND] = {DECODE_COMMAND, 0x00, IDLE, true};
+        // for the *_MEMCARD_ID_* and *_COMMAND_ACK_* states, command is supposed to be 0x00 but what can we do if it's not?
+        chain(
+            {
+                READ_RECV_MEMCARD_ID_1, READ_RECV_MEMCARD_ID_2,
+                READ_SEND_ADDRESS_MSB, READ_SEND_ADDRESS_LSB,
+                READ_RECV_COMMAND_ACK_1, READ_RECV_COMMAND_ACK_2,
+                READ_RECV_CONFIRM_ADDRESS_MSB, READ_RECV_CONFIRM_ADDRESS_LSB,
+                READ_RECV_DATA_SECTOR, READ_RECV_CHECKSUM, READ_RECV_END_BYTE,
+            },
+            {
+                {RESPOND, MEMCARD_ID_1}, {RESPOND, MEMCARD_ID_2},
+                {LATCH_ADDRESS_MSB, 0x00}, {LATCH_ADDRESS_LSB, 0x00},
+                {RESPOND, COMMAND_ACK_1}, {RESPOND, COMMAND_ACK_2},
+                {CONFIRM_ADDRESS_MSB, 0x00}, {CONFIRM_ADDRESS_LSB, 0x00},
+                {READ_DATA, 0x00}, {READ_CHECKSUM, 0x00},
+                {RESPOND, 0x47}, // should always be 0x47 for "Good read"
+            }
+        );
+        chain(
+            {
+                WRITE_RECV_MEMCARD_ID_1, WRITE_RECV_MEMCARD_ID_2,
+                WRITE_SEND_ADDRESS_MSB, WRITE_SEND_ADDRESS_LSB,
+                WRITE_SEND_DATA_SECTOR, WRITE_SEND_CHECKSUM,
+                WRITE_RECV_COMMAND_ACK_1, WRITE_RECV_COMMAND_ACK_2,
+                WRITE_RECV_END_BYTE,
+            },
+            {
+                {RESPOND, MEMCARD_ID_1}, {RESPOND, MEMCARD_ID_2},
+                {LATCH_ADDRESS_MSB, 0x00}, {LATCH_ADDRESS_LSB, 0x00},
+                {WRITE_DATA, 0x00}, {WRITE_CHECKSUM, 0x00},
+                {RESPOND, COMMAND_ACK_1}, {RESPOND, COMMAND_ACK_2},
+                {WRITE_STATUS, 0x00},
+            }
+        );
+        chain(
+            {
+                GET_ID_RECV_MEMCARD_ID_1, GET_ID_RECV_MEMCARD_ID_2,
+                GET_ID_RECV_COMMAND_ACK_1, GET_ID_RECV_COMMAND_ACK_2,
+                GET_ID_RECV_INFO_1, GET_ID_RECV_INFO_2, GET_ID_RECV_INFO_3, GET_ID_RECV_INFO_4,
+            },
+            {
+                {RESPOND, MEMCARD_ID_1}, {RESPOND, MEMCARD_ID_2},
+                {RESPOND, COMMAND_ACK_1}, {RESPOND, COMMAND_ACK_2},
+                {RESPOND, MEMCARD_INFO[0]}, {RESPOND, MEMCARD_INFO[1]},
+                {RESPOND, MEMCARD_INFO[2]}, {RESPOND, MEMCARD_INFO[3]},
+            }
+        );
+        return table;
+    }();
 }
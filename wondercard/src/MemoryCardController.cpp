@@ -0,0 +1,165 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include <cstddef>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/MemoryCardController.hpp>
+#include <wondercard/MemoryCardSlot.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    // a slot, its queue of pending operations and the thread which runs them
+    struct MemoryCardController::Worker {
+        MemoryCardSlot slot;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<std::function<void(MemoryCardSlot&)>> queue;
+        bool stopping = false;
+        std::thread thread; // started last, once everything else is ready
+
+        Worker() : thread(&Worker::run, this) {}
+
+        // also stops the thread, so that a controller which fails part-way through construction cleans up after itself
+        ~Worker() {
+            this->stop();
+            this->thread.join();
+        }
+
+        // tells the thread to stop once it has finished everything queued
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->stopping = true;
+            }
+            this->wake.notify_one();
+        }
+
+        void run() {
+            while (true) {
+                std::function<void(MemoryCardSlot&)> task;
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->wake.wait(lock, [this] { return this->stopping or not this->queue.empty(); });
+                    // only stop once everything queued has been done
+                    if (this->queue.empty()) {
+                        return;
+                    }
+                    task = std::move(this->queue.front());
+                    this->queue.pop_front();
+                }
+                task(this->slot);
+            }
+        }
+    };
+
+    MemoryCardController::MemoryCardController(std::size_t slot_count) {
+        this->_workers.reserve(slot_count);
+        for (std::size_t i = 0; i < slot_count; i++) {
+            this->_workers.push_back(std::make_unique<Worker>());
+        }
+    }
+
+    MemoryCardController::~MemoryCardController() {
+        // tell them all first, so they finish their queues in parallel before each is joined as it is destroyed
+        for (auto& worker : this->_workers) {
+            worker->stop();
+        }
+    }
+
+    std::size_t MemoryCardController::slot_count() const {
+        return this->_workers.size();
+    }
+
+    std::future<bool> MemoryCardController::insert_card(std::size_t slot, MemoryCard& card) {
+        return this->submit(slot, [&card](MemoryCardSlot& card_slot) {
+            return card_slot.insert_card(card);
+        });
+    }
+
+    std::future<bool> MemoryCardController::remove_card(std::size_t slot) {
+        return this->submit(slot, [](MemoryCardSlot& card_slot) {
+            return card_slot.remove_card();
+        });
+    }
+
+    std::future<MemoryCardSlot::Result> MemoryCardController::read_card(std::size_t slot, std::span<Byte, MemoryCard::CARD_SIZE> data, std::size_t start) {
+        return this->submit(slot, [data, start](MemoryCardSlot& card_slot) {
+            return card_slot.read_card(data, start);
+        });
+    }
+
+    std::future<MemoryCardSlot::Result> MemoryCardController::write_card(std::size_t slot, std::span<Byte, MemoryCard::CARD_SIZE> data, std::size_t start) {
+        return this->submit(slot, [data, start](MemoryCardSlot& card_slot) {
+            return card_slot.write_card(data, start);
+        });
+    }
+
+    std::future<MemoryCardSlot::Result> MemoryCardController::write_card_delta(
+        std::size_t slot,
+        std::span<Byte, MemoryCard::CARD_SIZE> data,
+        std::span<const Byte, MemoryCard::CARD_SIZE> base,
+        std::size_t start
+    ) {
+        return this->submit(slot, [data, base, start](MemoryCardSlot& card_slot) {
+            return card_slot.write_card_delta(data, base, start);
+        });
+    }
+
+    std::future<MemoryCardSlot::Result> MemoryCardController::read_block(std::size_t slot, std::size_t index, MemoryCard::Block data) {
+        return this->submit(slot, [index, data](MemoryCardSlot& card_slot) {
+            return card_slot.read_block(index, data);
+        });
+    }
+
+    std::future<MemoryCardSlot::Result> MemoryCardController::write_block(std::size_t slot, std::size_t index, MemoryCard::Block data) {
+        return this->submit(slot, [index, data](MemoryCardSlot& card_slot) {
+            return card_slot.write_block(index, data);
+        });
+    }
+
+    std::future<MemoryCardSlot::Result> MemoryCardController::read_sector(std::size_t slot, std::size_t index, MemoryCard::Sector data) {
+        return this->submit(slot, [index, data](MemoryCardSlot& card_slot) {
+            return card_slot.read_sector(index, data);
+        });
+    }
+
+    std::future<MemoryCardSlot::Result> MemoryCardController::write_sector(std::size_t slot, std::size_t index, MemoryCard::Sector data) {
+        return this->submit(slot, [index, data](MemoryCardSlot& card_slot) {
+            return card_slot.write_sector(index, data);
+        });
+    }
+
+    void MemoryCardController::_enqueue(std::size_t slot, std::function<void(MemoryCardSlot&)> task) {
+        if (slot >= this->_workers.size()) {
+            throw std::out_of_range("MemoryCardController slot index out of range");
+        }
+        Worker& worker = *this->_workers[slot];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.queue.push_back(std::move(task));
+        }
+        worker.wake.notify_one();
+    }
+}
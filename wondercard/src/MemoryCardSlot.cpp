@@ -10,17 +10,45 @@
  *
  */
 
+#include <algorithm>
 #include <array>
+#include <memory>
 #include <optional>
+#include <span>
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 
 #include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
 #include <wondercard/MemoryCardSlot.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+#include <wondercard/SectorCache.hpp>
 
 
 namespace com::saxbophone::wondercard {
-    MemoryCardSlot::MemoryCardSlot() : _inserted_card(nullptr) {}
+    namespace {
+        // compares a word at a time, which the compiler can turn into vector compares
+        bool sectors_equal(const Byte* a, const Byte* b) {
+            std::uint64_t difference = 0;
+            for (std::size_t i = 0; i < MemoryCard::SECTOR_SIZE; i += sizeof(difference)) {
+                std::uint64_t x, y;
+                std::memcpy(&x, a + i, sizeof(x));
+                std::memcpy(&y, b + i, sizeof(y));
+                difference |= x ^ y;
+            }
+            return difference == 0;
+        }
+    }
+
+    MemoryCardSlot::MemoryCardSlot()
+      : _inserted_card(nullptr)
+      , _direct_mode(false)
+      , _trace(nullptr)
+      , _cache_stats{}
+      , _card_new(true)
+      {}
 
     bool MemoryCardSlot::send(
         TriState command,
@@ -30,8 +58,12 @@ namespace com::saxbophone::wondercard {
         if (this->_inserted_card == nullptr) {
             return false;
         }
+        // whatever is sent might change the card's data
+        if (this->_cache != nullptr) {
+            this->_cache->clear();
+        }
         // pass on the call to MemoryCard.send()
-        return this->_inserted_card->send(command, data);
+        return this->_exchange(command, data);
     }
 
     bool MemoryCardSlot::insert_card(MemoryCard& card) {
@@ -45,6 +77,13 @@ namespace com::saxbophone::wondercard {
         } else {
             // insert the card
             this->_inserted_card = &card;
+            // a card that has just been powered on is new
+            this->_card_new = true;
+            if (this->_cache != nullptr) {
+                this->_cache->clear();
+            }
+            // so that the card can tell the cache about changes not made through us
+            card._slot_cache = this->_cache;
             return true;
         }
     }
@@ -57,58 +96,189 @@ namespace com::saxbophone::wondercard {
         // power down the card
         this->_inserted_card->power_off();
         // remove the card
+        this->_inserted_card->_slot_cache.reset();
         this->_inserted_card = nullptr;
+        if (this->_cache != nullptr) {
+            this->_cache->clear();
+        }
         return true;
     }
 
-    bool MemoryCardSlot::read_card(std::span<Byte, MemoryCard::CARD_SIZE> data) {
+    void MemoryCardSlot::set_direct_mode(bool enabled) {
+        this->_direct_mode = enabled;
+    }
+
+    bool MemoryCardSlot::direct_mode() const {
+        return this->_direct_mode;
+    }
+
+    void MemoryCardSlot::set_trace(ProtocolTrace* trace) {
+        this->_trace = trace;
+    }
+
+    ProtocolTrace* MemoryCardSlot::trace() const {
+        return this->_trace;
+    }
+
+    bool MemoryCardSlot::trace_supported() {
+#ifdef WONDERCARD_PROTOCOL_TRACE
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void MemoryCardSlot::set_cache_capacity(std::size_t sectors) {
+        if (sectors == 0) {
+            this->_cache.reset();
+        } else {
+            this->_cache = std::make_shared<SectorCache>(sectors);
+        }
+        if (this->_inserted_card != nullptr) {
+            this->_inserted_card->_slot_cache = this->_cache;
+        }
+        this->_cache_stats = {};
+    }
+
+    std::size_t MemoryCardSlot::cache_capacity() const {
+        return this->_cache != nullptr ? this->_cache->capacity() : 0;
+    }
+
+    MemoryCardSlot::CacheStats MemoryCardSlot::cache_stats() const {
+        return this->_cache_stats;
+    }
+
+    bool MemoryCardSlot::_exchange(TriState command, TriState& data) {
+#ifdef WONDERCARD_PROTOCOL_TRACE
+        if (this->_trace != nullptr) [[unlikely]] {
+            // the card only writes data when it drives the line
+            TriState response = std::nullopt;
+            bool ack = this->_inserted_card->send(command, response);
+            this->_trace->push({command, response, ack});
+            if (response.has_value()) {
+                data = response;
+            }
+            return ack;
+        }
+#endif
+        return this->_inserted_card->send(command, data);
+    }
+
+    MemoryCardSlot::Result MemoryCardSlot::read_card(std::span<Byte, MemoryCard::CARD_SIZE> data, std::size_t start) {
+        start = std::min(start, MemoryCard::CARD_SECTOR_COUNT);
         // guard against reading when no card in slot
         if (this->_inserted_card == nullptr) {
-            return false;
+            return {MemoryCardSlot::Error::NO_CARD, (std::uint16_t)start, 0};
         }
-        // retrieve each block of the card using template recursion
-        return this->_read_card_block<0>(data);
+        // retrieve each remaining sector of the card
+        return this->_read_sectors(start, data.subspan(start * MemoryCard::SECTOR_SIZE));
     }
 
-    bool MemoryCardSlot::write_card(std::span<Byte, MemoryCard::CARD_SIZE> data) {
+    MemoryCardSlot::Result MemoryCardSlot::write_card(std::span<Byte, MemoryCard::CARD_SIZE> data, std::size_t start) {
+        start = std::min(start, MemoryCard::CARD_SECTOR_COUNT);
         // guard against writing when no card in slot
         if (this->_inserted_card == nullptr) {
-            return false;
+            return {MemoryCardSlot::Error::NO_CARD, (std::uint16_t)start, 0};
         }
-        // write each block of the card using template recursion
-        return this->_write_card_block<0>(data);
+        // write each remaining sector of the card
+        return this->_write_sectors(start, data.subspan(start * MemoryCard::SECTOR_SIZE));
     }
 
-    bool MemoryCardSlot::read_block(std::size_t index, MemoryCard::Block data) {
-        // guard against reading when no card in slot
+    MemoryCardSlot::Result MemoryCardSlot::write_card_delta(
+        std::span<Byte, MemoryCard::CARD_SIZE> data,
+        std::span<const Byte, MemoryCard::CARD_SIZE> base,
+        std::size_t start
+    ) {
+        start = std::min(start, MemoryCard::CARD_SECTOR_COUNT);
+        // guard against writing when no card in slot
         if (this->_inserted_card == nullptr) {
-            return false;
+            return {MemoryCardSlot::Error::NO_CARD, (std::uint16_t)start, 0};
         }
-        // TODO: Validate index???
+        // write only the remaining sectors which have changed
+        for (std::size_t i = start; i < MemoryCard::CARD_SECTOR_COUNT; i++) {
+            std::size_t offset = i * MemoryCard::SECTOR_SIZE;
+            if (sectors_equal(data.data() + offset, base.data() + offset)) {
+                continue;
+            }
+            Result result = this->write_sector(i, data.subspan(offset).first<MemoryCard::SECTOR_SIZE>());
+            if (not result) {
+                return result;
+            }
+        }
+        // all done, nothing left to resume from
+        return {MemoryCardSlot::Error::NONE, (std::uint16_t)MemoryCard::CARD_SECTOR_COUNT, 0};
+    }
+
+    MemoryCardSlot::Result MemoryCardSlot::read_block(std::size_t index, MemoryCard::Block data) {
         // calculate first sector of block (just shift block number by number of bits of sectors)
         std::size_t block_sector = index << 6;
-        // retrieve each sector of the block using template recursion
-        return this->_read_block_sector<0>(block_sector, data);
+        // guard against reading when no card in slot
+        if (this->_inserted_card == nullptr) {
+            return {MemoryCardSlot::Error::NO_CARD, (std::uint16_t)block_sector, 0};
+        }
+        // TODO: Validate index???
+        // retrieve each sector of the block
+        return this->_read_sectors(block_sector, data);
     }
 
-    bool MemoryCardSlot::write_block(std::size_t index, MemoryCard::Block data) {
+    MemoryCardSlot::Result MemoryCardSlot::write_block(std::size_t index, MemoryCard::Block data) {
+        // calculate first sector of block (just shift block number by number of bits of sectors)
+        std::size_t block_sector = index << 6;
         // guard against writing when no card in slot
         if (this->_inserted_card == nullptr) {
-            return false;
+            return {MemoryCardSlot::Error::NO_CARD, (std::uint16_t)block_sector, 0};
         }
         // TODO: Validate index???
-        // calculate first sector of block (just shift block number by number of bits of sectors)
-        std::size_t block_sector = index << 6;
-        // write each sector of the block using template recursion
-        return this->_write_block_sector<0>(block_sector, data);
+        // write each sector of the block
+        return this->_write_sectors(block_sector, data);
     }
 
-    bool MemoryCardSlot::read_sector(std::size_t index, MemoryCard::Sector data) {
+    MemoryCardSlot::Result MemoryCardSlot::read_sector(std::size_t index, MemoryCard::Sector data) {
+        // guard against reading when no card in slot
+        if (this->_inserted_card == nullptr or this->_cache == nullptr) {
+            return this->_read_sector(index, data);
+        }
+        // only the low 10 bits of the sector number are sent to the card
+        std::size_t address = index % MemoryCard::CARD_SECTOR_COUNT;
+        if (this->_cache->get(address, data)) {
+            this->_cache_stats.hits++;
+            this->_cache_stats.bytes_saved += MemoryCardSlot::_READ_SECTOR_LENGTH;
+            return {MemoryCardSlot::Error::NONE, (std::uint16_t)index, 0};
+        }
+        this->_cache_stats.misses++;
+        Result result = this->_read_sector(index, data);
+        if (result) {
+            this->_cache->put(address, data);
+        }
+        return result;
+    }
+
+    MemoryCardSlot::Result MemoryCardSlot::write_sector(std::size_t index, MemoryCard::Sector data) {
+        Result result = this->_write_sector(index, data);
+        if (this->_inserted_card != nullptr and this->_cache != nullptr) {
+            // write-through, or forget the sector if it's unknown what the card now holds
+            std::size_t address = index % MemoryCard::CARD_SECTOR_COUNT;
+            if (result) {
+                this->_cache->put(address, data);
+            } else {
+                this->_cache->erase(address);
+            }
+        }
+        return result;
+    }
+
+    MemoryCardSlot::Result MemoryCardSlot::_read_sector(std::size_t index, MemoryCard::Sector data) {
+        std::uint16_t sector = (std::uint16_t)index;
         // guard against reading when no card in slot
         if (this->_inserted_card == nullptr) {
-            return false;
+            return {MemoryCardSlot::Error::NO_CARD, sector, 0};
         }
         // TODO: Validate index???
+        // take the shortcut if allowed (falls back to protocol if card is busy)
+        if (this->_direct_mode and this->_inserted_card->direct_read_sector(index, data)) {
+            this->_observe_flag(this->_inserted_card->_flag);
+            return {MemoryCardSlot::Error::NONE, sector, 0};
+        }
         // scratchpad variable for card responses
         TriState output = std::nullopt;
         // get MSB and LSB of sector index
@@ -123,50 +293,72 @@ namespace com::saxbophone::wondercard {
             {},   {},   0x5A, 0x5D, {},  {},  0x5C, 0x5D, msb,  lsb,
         };
         // send each command in commands sequence and bail if no ACK or response wrong
-        for (std::size_t i = 0; i < 10; i++) {
-            if (!this->_inserted_card->send(commands[i], output)) {
-                return false; // no ACK, oh dear!
+        for (std::uint16_t i = 0; i < 10; i++) {
+            if (!this->_exchange(commands[i], output)) {
+                return {MemoryCardSlot::Error::NO_ACK, sector, i}; // no ACK, oh dear!
+            }
+            // the card replies to the command byte with its FLAG
+            if (i == 1) {
+                this->_observe_flag(output);
             }
             // validate response unless response is don't-care
             if (
                 valid_responses[i] != std::nullopt and
                 output != valid_responses[i]
             ) {
-                return false; // invalid response
+                // a card which won't read the sector confirms the address as FFFFh
+                if (i == 8 and output == 0xFF) {
+                    return {MemoryCardSlot::Error::BAD_SECTOR, sector, i};
+                }
+                return {MemoryCardSlot::Error::BAD_RESPONSE, sector, i};
             }
         }
-        // calculate checksum value so far (MSB XOR LSB)
-        Byte checksum = msb ^ lsb;
         // if this point is reached, we are ready to read sector data
         for (std::size_t i = 0; i < MemoryCard::SECTOR_SIZE; i++) {
-            if (!this->_inserted_card->send(0x00, output)) {
-                return false; // no ACK, oh dear!
+            std::uint16_t byte = (std::uint16_t)(10u + i);
+            if (!this->_exchange(0x00, output)) {
+                return {MemoryCardSlot::Error::NO_ACK, sector, byte}; // no ACK, oh dear!
             }
             // if output is high-z, bail immediately
             if (output == std::nullopt) {
-                return false;
+                return {MemoryCardSlot::Error::BAD_RESPONSE, sector, byte};
             }
             // store output (sector data) into return param
-            data[i] = output.value(); // guaranteed not high-Z due to guard clause
-            // update checksum
-            checksum ^= data[i];
+            data[i] = *output; // guaranteed not high-Z due to guard clause
         }
+        // checksum is MSB XOR LSB XOR all the data, worked out in one go
+        Byte checksum = msb ^ lsb ^ MemoryCard::sector_parity(data);
         TriState card_checksum = std::nullopt;
         // receive card-calculated checksum
-        if (!this->_inserted_card->send(0x00, card_checksum)) {
-            return false; // no ACK
+        if (!this->_exchange(0x00, card_checksum)) {
+            return {MemoryCardSlot::Error::NO_ACK, sector, 138}; // no ACK
         }
         // end byte should always be 0x47 and never ACK
-        bool end_ack = this->_inserted_card->send(0x00, output);
-        return end_ack == false and output == 0x47 and card_checksum == checksum;
+        bool end_ack = this->_exchange(0x00, output);
+        if (end_ack or output != 0x47) {
+            return {MemoryCardSlot::Error::BAD_RESPONSE, sector, 139};
+        }
+        if (card_checksum != checksum) {
+            return {MemoryCardSlot::Error::CHECKSUM_MISMATCH, sector, 138};
+        }
+        return {MemoryCardSlot::Error::NONE, sector, 0};
     }
 
-    bool MemoryCardSlot::write_sector(std::size_t index, MemoryCard::Sector data) {
+    MemoryCardSlot::Result MemoryCardSlot::_write_sector(std::size_t index, MemoryCard::Sector data) {
+        std::uint16_t sector = (std::uint16_t)index;
         // guard against writing when no card in slot
         if (this->_inserted_card == nullptr) {
-            return false;
+            return {MemoryCardSlot::Error::NO_CARD, sector, 0};
         }
         // TODO: Validate index???
+        // take the shortcut if allowed (falls back to protocol if card is busy)
+        if (this->_direct_mode and this->_inserted_card->_state == MemoryCard::State::IDLE) {
+            // the FLAG as it would have been replied to the command byte
+            this->_observe_flag(this->_inserted_card->_flag);
+            if (this->_inserted_card->direct_write_sector(index, data)) {
+                return {MemoryCardSlot::Error::NONE, sector, 0};
+            }
+        }
         // scratchpad variable for card responses
         TriState output = std::nullopt;
         // get MSB and LSB of sector index
@@ -181,115 +373,99 @@ namespace com::saxbophone::wondercard {
             {},   {},   0x5A, 0x5D, {},  {},
         };
         // send each command in commands sequence and bail if no ACK or response wrong
-        for (std::size_t i = 0; i < 6; i++) {
-            if (!this->_inserted_card->send(commands[i], output)) {
-                return false; // no ACK, oh dear!
+        for (std::uint16_t i = 0; i < 6; i++) {
+            if (!this->_exchange(commands[i], output)) {
+                return {MemoryCardSlot::Error::NO_ACK, sector, i}; // no ACK, oh dear!
+            }
+            // the card replies to the command byte with its FLAG
+            if (i == 1) {
+                this->_observe_flag(output);
             }
             // validate response unless response is don't-care
             if (
                 valid_responses[i] != std::nullopt and
                 output != valid_responses[i]
             ) {
-                return false; // invalid response
+                return {MemoryCardSlot::Error::BAD_RESPONSE, sector, i}; // invalid response
             }
         }
-        // calculate checksum value so far (MSB XOR LSB)
-        Byte checksum = msb ^ lsb;
         // if this point is reached, we are ready to write sector data
         for (std::size_t i = 0; i < MemoryCard::SECTOR_SIZE; i++) {
-            if (!this->_inserted_card->send(data[i], output)) {
-                return false; // no ACK, oh dear!
+            if (!this->_exchange(data[i], output)) {
+                return {MemoryCardSlot::Error::NO_ACK, sector, (std::uint16_t)(6u + i)}; // no ACK, oh dear!
             }
-            // update checksum
-            checksum ^= data[i];
         }
+        // checksum is MSB XOR LSB XOR all the data, worked out in one go
+        Byte checksum = msb ^ lsb ^ MemoryCard::sector_parity(data);
         // send our calculated checksum value
-        if (!this->_inserted_card->send(checksum, output)) {
-            return false; // no ACK
+        if (!this->_exchange(checksum, output)) {
+            return {MemoryCardSlot::Error::NO_ACK, sector, 134}; // no ACK
         }
         // next two bytes received should be "Command Acknowledge" followed by end byte status
         TriState footer_responses[] = {
             0x5C, 0x5D,   {},
         };
-        for (std::size_t i = 0; i < 3; i++) {
+        for (std::uint16_t i = 0; i < 3; i++) {
+            std::uint16_t byte = (std::uint16_t)(135u + i);
             // all remaining commands send 00h
-            bool ack = this->_inserted_card->send(0x00, output);
+            bool ack = this->_exchange(0x00, output);
             if (i != 2 and not ack) {
-                return false; // expect ACK on all but last
+                return {MemoryCardSlot::Error::NO_ACK, sector, byte}; // expect ACK on all but last
             }
             // validate response unless response is don't-care
             if (
                 footer_responses[i] != std::nullopt and
                 output != footer_responses[i]
             ) {
-                return false; // invalid response
+                return {MemoryCardSlot::Error::BAD_RESPONSE, sector, byte}; // invalid response
             }
         }
-        // TODO: We really need a way to tell apart different kinds of fail
-        return output == 0x47; // 0x4Eh = Bad Checksum, 0xFFh = Bad Sector
-    }
-
-    template <std::size_t sector_index>
-    bool MemoryCardSlot::_read_block_sector(std::size_t block_sector, MemoryCard::Block data) {
-        // use subspan to write sector data to output
-        MemoryCard::Sector sector = data.subspan<sector_index * MemoryCard::SECTOR_SIZE, MemoryCard::SECTOR_SIZE>();
-        // base case
-        if constexpr (sector_index == (MemoryCard::BLOCK_SECTOR_COUNT - 1)) {
-            // last sector
-            return this->read_sector(block_sector + sector_index, sector);
+        // status end byte
+        if (output == 0x47) {        // Good
+            return {MemoryCardSlot::Error::NONE, sector, 0};
+        } else if (output == 0x4E) { // Bad Checksum
+            return {MemoryCardSlot::Error::BAD_CHECKSUM, sector, 137};
+        } else if (output == 0xFF) { // Bad Sector
+            return {MemoryCardSlot::Error::BAD_SECTOR, sector, 137};
         } else {
-            // this and next sector (recursive template call)
-            return
-                this->read_sector(block_sector + sector_index, sector) and
-                this->_read_block_sector<sector_index + 1>(block_sector, data);
+            return {MemoryCardSlot::Error::BAD_RESPONSE, sector, 137};
         }
     }
 
-    template <std::size_t sector_index>
-    bool MemoryCardSlot::_write_block_sector(std::size_t block_sector, MemoryCard::Block data) {
-        // use subspan to write sector data to card
-        MemoryCard::Sector sector = data.subspan<sector_index * MemoryCard::SECTOR_SIZE, MemoryCard::SECTOR_SIZE>();
-        // base case
-        if constexpr (sector_index == (MemoryCard::BLOCK_SECTOR_COUNT - 1)) {
-            // last sector
-            return this->write_sector(block_sector + sector_index, sector);
-        } else {
-            // this and next sector (recursive template call)
-            return
-                this->write_sector(block_sector + sector_index, sector) and
-                this->_write_block_sector<sector_index + 1>(block_sector, data);
+    void MemoryCardSlot::_observe_flag(TriState flag) {
+        bool card_new = flag.value_or(0x00) & MemoryCard::_FLAG_NEW_CARD;
+        // the card can only have become new again by being powered off and on
+        if (card_new and not this->_card_new and this->_cache != nullptr) {
+            this->_cache->clear();
         }
+        this->_card_new = card_new;
     }
 
-    template <std::size_t block_index>
-    bool MemoryCardSlot::_read_card_block(std::span<Byte, MemoryCard::CARD_SIZE> data) {
-        // use subspan to write block data to output
-        MemoryCard::Block block = data.subspan<block_index * MemoryCard::BLOCK_SIZE, MemoryCard::BLOCK_SIZE>();
-        // base case
-        if constexpr (block_index == (MemoryCard::CARD_BLOCK_COUNT - 1)) {
-            // last block
-            return this->read_block(block_index, block);
-        } else {
-            // this and next block (recursive template call)
-            return
-                this->read_block(block_index, block) and
-                this->_read_card_block<block_index + 1>(data);
+    MemoryCardSlot::Result MemoryCardSlot::_read_sectors(std::size_t first, std::span<Byte> data) {
+        std::size_t count = data.size() / MemoryCard::SECTOR_SIZE;
+        for (std::size_t i = 0; i < count; i++) {
+            MemoryCard::Sector sector = data.subspan(i * MemoryCard::SECTOR_SIZE).first<MemoryCard::SECTOR_SIZE>();
+            Result result = this->read_sector(first + i, sector);
+            if (not result) {
+                return result;
+            }
         }
+        // all done, nothing left to resume from
+        return {MemoryCardSlot::Error::NONE, (std::uint16_t)(first + count), 0};
     }
 
-    template <std::size_t block_index>
-    bool MemoryCardSlot::_write_card_block(std::span<Byte, MemoryCard::CARD_SIZE> data) {
-        // use subspan to write block data to card
-        MemoryCard::Block block = data.subspan<block_index * MemoryCard::BLOCK_SIZE, MemoryCard::BLOCK_SIZE>();
-        // base case
-        if constexpr (block_index == (MemoryCard::CARD_BLOCK_COUNT - 1)) {
-            // last block
-            return this->write_block(block_index, block);
-        } else {
-            // this and next block (recursive template call)
-            return
-                this->write_block(block_index, block) and
-                this->_write_card_block<block_index + 1>(data);
+    MemoryCardSlot::Result MemoryCardSlot::_write_sectors(std::size_t first, std::span<Byte> data) {
+        std::size_t count = data.size() / MemoryCard::SECTOR_SIZE;
+        for (std::size_t i = 0; i < count; i++) {
+            MemoryCard::Sector sector = data.subspan(i * MemoryCard::SECTOR_SIZE).first<MemoryCard::SECTOR_SIZE>();
+            Result result = this->write_sector(first + i, sector);
+            if (not result) {
+                return result;
+            }
         }
+        // all done, nothing left to resume from
+        return {MemoryCardSlot::Error::NONE, (std::uint16_t)(first + count), 0};
     }
+
+    const std::size_t MemoryCardSlot::_READ_SECTOR_LENGTH = 140;
 }
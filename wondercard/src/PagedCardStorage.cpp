@@ -0,0 +1,139 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#include <array>
+#include <span>
+#include <system_error>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+// version 2 lives in kernel32, so there's no need to link psapi
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/PagedCardStorage.hpp>
+
+
+namespace com::saxbophone::wondercard {
+#ifdef _WIN32
+    PagedCardStorage::PagedCardStorage() {
+        // committed pages are only given real memory when first touched
+        void* memory = VirtualAlloc(nullptr, MemoryCard::CARD_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        if (memory == nullptr) {
+            throw std::system_error((int)GetLastError(), std::system_category(), "Can't reserve card memory");
+        }
+        this->_data = (Byte*)memory;
+    }
+
+    PagedCardStorage::~PagedCardStorage() {
+        VirtualFree(this->_data, 0, MEM_RELEASE);
+    }
+
+    std::size_t PagedCardStorage::resident_size() {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        std::size_t page_size = info.dwPageSize;
+        std::size_t resident = 0;
+        for (std::size_t offset = 0; offset < MemoryCard::CARD_SIZE; offset += page_size) {
+            PSAPI_WORKING_SET_EX_INFORMATION page = {};
+            page.VirtualAddress = this->_data + offset;
+            if (QueryWorkingSetEx(GetCurrentProcess(), &page, sizeof(page)) and page.VirtualAttributes.Valid) {
+                resident += page_size;
+            }
+        }
+        return resident;
+    }
+#else
+    PagedCardStorage::PagedCardStorage() {
+        // private anonymous pages read as the shared zero page until written
+        void* memory = ::mmap(
+            nullptr,
+            MemoryCard::CARD_SIZE,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+            -1,
+            0
+        );
+        if (memory == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category(), "Can't reserve card memory");
+        }
+        this->_data = (Byte*)memory;
+    }
+
+    PagedCardStorage::~PagedCardStorage() {
+        ::munmap(this->_data, MemoryCard::CARD_SIZE);
+    }
+
+    std::size_t PagedCardStorage::resident_size() {
+        std::size_t page_size = (std::size_t)::sysconf(_SC_PAGESIZE);
+        std::size_t resident = 0;
+#ifdef __linux__
+        /*
+         * mincore() counts pages mapped to the shared zero page as resident,
+         * but the pagemap tells them apart: a page written to by us is both
+         * present (bit 63) and mapped exclusively by this process (bit 56)
+         */
+        int pagemap = ::open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+        if (pagemap >= 0) {
+            bool ok = true;
+            for (std::size_t offset = 0; ok and offset < MemoryCard::CARD_SIZE; offset += page_size) {
+                std::uint64_t entry;
+                off_t position = (off_t)((std::uintptr_t)(this->_data + offset) / page_size * sizeof(entry));
+                ok = ::pread(pagemap, &entry, sizeof(entry), position) == (ssize_t)sizeof(entry);
+                if (ok and (entry >> 63 & 1u) and (entry >> 56 & 1u)) {
+                    resident += page_size;
+                }
+            }
+            ::close(pagemap);
+            if (ok) {
+                return resident;
+            }
+            resident = 0;
+        }
+#endif
+        // fall back to mincore(), which may count pages which have only been read
+#ifdef __APPLE__
+        typedef char PageStatus;
+#else
+        typedef unsigned char PageStatus;
+#endif
+        std::array<PageStatus, MemoryCard::CARD_SIZE / 4096u> pages = {};
+        if (page_size < 4096u or ::mincore(this->_data, MemoryCard::CARD_SIZE, pages.data()) != 0) {
+            // can't tell, so assume the worst
+            return MemoryCard::CARD_SIZE;
+        }
+        for (std::size_t i = 0; i < MemoryCard::CARD_SIZE / page_size; i++) {
+            if (pages[i] & 1u) {
+                resident += page_size;
+            }
+        }
+        return resident;
+    }
+#endif
+
+    std::span<Byte> PagedCardStorage::bytes() {
+        return std::span<Byte>(this->_data, MemoryCard::CARD_SIZE);
+    }
+}
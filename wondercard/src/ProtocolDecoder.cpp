@@ -0,0 +1,152 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+
+#include <span>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/ProtocolDecoder.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    ProtocolDecoder::ProtocolDecoder()
+      : _offset(0)
+      , _start(0)
+      , _position(0)
+      , _sector(0x0000)
+      , _command(0x00)
+      , _flag(0x00)
+      , _checksum(0x00)
+      , _checksum_valid(false)
+      , _data{}
+      {}
+
+    bool ProtocolDecoder::feed(const ProtocolTrace::Record& record, Event& event) {
+        std::uint64_t offset = this->_offset++;
+        if (this->_position == 0) {
+            // only a Memory Card ACKing its address byte starts a transaction
+            if (record.mosi == 0x81 and record.ack) {
+                this->_start = offset;
+                this->_position = 1;
+            }
+            return false;
+        }
+        // Z-state is read as 0xFF, as the card itself does
+        Byte command = record.mosi.value_or(0xFF);
+        Byte response = record.miso.value_or(0xFF);
+        std::uint16_t position = this->_position++;
+        if (position == 1) {
+            this->_command = command;
+            this->_flag = response;
+        } else if (position == 4) { // address MSB, for reads and writes
+            this->_sector = (std::uint16_t)(command << 8);
+            this->_checksum = command;
+        } else if (position == 5) { // address LSB
+            this->_sector |= command;
+            this->_checksum ^= command;
+        } else if (this->_command == 0x52) {
+            if (position >= ProtocolDecoder::_READ_DATA_START and position < ProtocolDecoder::_READ_CHECKSUM) {
+                this->_data[position - ProtocolDecoder::_READ_DATA_START] = response;
+                this->_checksum ^= response;
+            } else if (position == ProtocolDecoder::_READ_CHECKSUM) {
+                this->_checksum_valid = response == this->_checksum;
+            }
+        } else if (this->_command == 0x57) {
+            if (position >= ProtocolDecoder::_WRITE_DATA_START and position < ProtocolDecoder::_WRITE_CHECKSUM) {
+                this->_data[position - ProtocolDecoder::_WRITE_DATA_START] = command;
+                this->_checksum ^= command;
+            } else if (position == ProtocolDecoder::_WRITE_CHECKSUM) {
+                this->_checksum_valid = command == this->_checksum;
+            }
+        }
+        // the card ACKs every byte of a transaction but the last
+        if (record.ack) {
+            return false;
+        }
+        this->_finish(position, response, event);
+        return true;
+    }
+
+    std::span<const Byte, MemoryCard::SECTOR_SIZE> ProtocolDecoder::sector_data() const {
+        return this->_data;
+    }
+
+    void ProtocolDecoder::reset() {
+        this->_position = 0;
+    }
+
+    void ProtocolDecoder::_finish(std::uint16_t position, Byte last_response, Event& event) {
+        event = {
+            EventKind::ABORTED,
+            this->_command,
+            this->_flag,
+            0x00,
+            false,
+            0x0000,
+            (std::uint16_t)(position + 1u),
+            this->_start,
+        };
+        switch (this->_command) {
+        case 0x52:
+            if (position == ProtocolDecoder::_READ_END) {
+                event.kind = EventKind::READ_SECTOR;
+                event.status = last_response;
+                event.checksum_valid = this->_checksum_valid;
+            } else if (position == ProtocolDecoder::_READ_BAD_SECTOR_END) {
+                // the card refuses to read a bad sector once it has confirmed it
+                event.kind = EventKind::READ_SECTOR;
+                event.status = 0xFF;
+            }
+            event.sector = this->_sector;
+            break;
+        case 0x57:
+            if (position == ProtocolDecoder::_WRITE_END) {
+                event.kind = EventKind::WRITE_SECTOR;
+                event.status = last_response;
+                event.checksum_valid = this->_checksum_valid;
+            }
+            event.sector = this->_sector;
+            break;
+        case 0x53:
+            if (position == ProtocolDecoder::_GET_ID_END) {
+                event.kind = EventKind::GET_ID;
+            }
+            break;
+        default:
+            if (position == 1) {
+                event.kind = EventKind::UNKNOWN_COMMAND;
+            }
+            break;
+        }
+        this->_position = 0;
+    }
+
+    /*
+     * Read: 0x81, command, ID x2, address x2, ACK x2, confirm address x2,
+     * data, checksum, end byte
+     */
+    const std::uint16_t ProtocolDecoder::_READ_DATA_START = 10;
+    const std::uint16_t ProtocolDecoder::_READ_CHECKSUM = ProtocolDecoder::_READ_DATA_START + MemoryCard::SECTOR_SIZE;
+    const std::uint16_t ProtocolDecoder::_READ_END = ProtocolDecoder::_READ_CHECKSUM + 1;
+    const std::uint16_t ProtocolDecoder::_READ_BAD_SECTOR_END = ProtocolDecoder::_READ_DATA_START - 1;
+    // Write: 0x81, command, ID x2, address x2, data, checksum, ACK x2, end byte
+    const std::uint16_t ProtocolDecoder::_WRITE_DATA_START = 6;
+    const std::uint16_t ProtocolDecoder::_WRITE_CHECKSUM = ProtocolDecoder::_WRITE_DATA_START + MemoryCard::SECTOR_SIZE;
+    const std::uint16_t ProtocolDecoder::_WRITE_END = ProtocolDecoder::_WRITE_CHECKSUM + 3;
+    // Get ID: 0x81, command, ID x2, ACK x2, info x4
+    const std::uint16_t ProtocolDecoder::_GET_ID_END = 9;
+}
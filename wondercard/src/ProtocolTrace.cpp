@@ -0,0 +1,72 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <span>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    ProtocolTrace::ProtocolTrace(std::size_t capacity)
+      : _capacity(std::bit_ceil(std::max(capacity, (std::size_t)1u)))
+      , _records(std::make_unique<Record[]>(this->_capacity))
+      , _head(0)
+      , _tail(0)
+      , _dropped(0)
+      {}
+
+    bool ProtocolTrace::push(const Record& record) {
+        std::size_t head = this->_head.load(std::memory_order_relaxed);
+        std::size_t tail = this->_tail.load(std::memory_order_acquire);
+        if (head - tail == this->_capacity) {
+            this->_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        this->_records[head & (this->_capacity - 1)] = record;
+        // publish the record to drain()
+        this->_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::size_t ProtocolTrace::drain(std::span<Record> records) {
+        std::size_t tail = this->_tail.load(std::memory_order_relaxed);
+        std::size_t head = this->_head.load(std::memory_order_acquire);
+        std::size_t count = std::min(head - tail, records.size());
+        for (std::size_t i = 0; i < count; i++) {
+            records[i] = this->_records[(tail + i) & (this->_capacity - 1)];
+        }
+        // hand the space back to push()
+        this->_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    std::size_t ProtocolTrace::size() const {
+        std::size_t tail = this->_tail.load(std::memory_order_acquire);
+        return this->_head.load(std::memory_order_acquire) - tail;
+    }
+
+    std::size_t ProtocolTrace::capacity() const {
+        return this->_capacity;
+    }
+
+    std::uint64_t ProtocolTrace::dropped() const {
+        return this->_dropped.load(std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,132 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#include <algorithm>
+#include <optional>
+#include <span>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/RewindJournal.hpp>
+#include <wondercard/SectorBitmap.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    RewindJournal::RewindJournal(std::size_t sector_capacity, std::size_t marker_capacity)
+      : _sector_capacity(std::max(sector_capacity, (std::size_t)1u))
+      , _marker_capacity(std::max(marker_capacity, (std::size_t)1u))
+      , _position(0)
+      , _next_marker(0)
+      {}
+
+    RewindJournal::Marker RewindJournal::mark(MemoryCard& card) {
+        MarkerEntry entry = {this->_next_marker++, this->_position, {}};
+        card.serialize(entry.state);
+        if (this->_markers.size() == this->_marker_capacity) {
+            this->_markers.pop_front();
+        }
+        this->_markers.push_back(entry);
+        this->restart_recording(card);
+        return entry.marker;
+    }
+
+    bool RewindJournal::rewind_to(MemoryCard& card, Marker marker) {
+        if (not this->can_rewind_to(marker)) {
+            return false;
+        }
+        const MarkerEntry& entry = *this->find(marker);
+        // undo the entries newest first, so each sector ends up as it was at the marker
+        for (std::uint64_t n = this->_position; n > entry.position; n--) {
+            const Entry& undo = this->_entries[(n - 1) % this->_sector_capacity];
+            std::copy(undo.old_data.begin(), undo.old_data.end(), card.get_sector(undo.sector).begin());
+            card.mark_dirty(undo.sector);
+        }
+        card.deserialize(entry.state);
+        this->_position = entry.position;
+        // forget everything after the marker, which is now the latest one
+        while (this->_markers.back().marker != marker) {
+            this->_markers.pop_back();
+        }
+        // the card may be back part-way through writing a sector
+        this->restart_recording(card);
+        return true;
+    }
+
+    bool RewindJournal::can_rewind_to(Marker marker) const {
+        const MarkerEntry* entry = this->find(marker);
+        return entry != nullptr and entry->position >= this->oldest_position();
+    }
+
+    void RewindJournal::clear() {
+        this->_entries.clear();
+        this->_position = 0;
+        this->_markers.clear();
+        this->_recorded.clear();
+    }
+
+    std::size_t RewindJournal::size() const {
+        return (std::size_t)(this->_position - this->oldest_position());
+    }
+
+    std::size_t RewindJournal::memory_usage() const {
+        return
+            sizeof(RewindJournal) +
+            this->_entries.capacity() * sizeof(Entry) +
+            this->_markers.size() * sizeof(MarkerEntry);
+    }
+
+    void RewindJournal::record(std::size_t sector, std::span<const Byte, MemoryCard::SECTOR_SIZE> old_data) {
+        // only the contents as of the last marker are needed to rewind
+        if (this->_recorded.test(sector)) {
+            return;
+        }
+        this->_recorded.set(sector);
+        std::size_t index = (std::size_t)(this->_position % this->_sector_capacity);
+        if (index == this->_entries.size()) {
+            this->_entries.emplace_back();
+        }
+        Entry& entry = this->_entries[index];
+        entry.sector = (std::uint16_t)sector;
+        std::copy(old_data.begin(), old_data.end(), entry.old_data.begin());
+        this->_position++;
+    }
+
+    void RewindJournal::restart_recording(MemoryCard& card) {
+        // the next write to any sector is the first since the marker
+        this->_recorded.clear();
+        /*
+         * a sector being written to was recorded before the marker, and won't
+         * be again, so record it as it is now in case the rest of it changes
+         */
+        if (std::optional<std::uint16_t> sector = card.sector_being_written()) {
+            this->record(*sector, card.sector_data(*sector));
+        }
+    }
+
+    std::uint64_t RewindJournal::oldest_position() const {
+        return this->_position > this->_sector_capacity ? this->_position - this->_sector_capacity : 0;
+    }
+
+    const RewindJournal::MarkerEntry* RewindJournal::find(Marker marker) const {
+        // markers are in ascending order
+        auto it = std::lower_bound(
+            this->_markers.begin(),
+            this->_markers.end(),
+            marker,
+            [](const MarkerEntry& entry, Marker m) { return entry.marker < m; }
+        );
+        return it != this->_markers.end() and it->marker == marker ? &*it : nullptr;
+    }
+}
@@ -0,0 +1,79 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#include <bit>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/SectorBitmap.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    SectorBitmap::SectorBitmap() : _words{} {}
+
+    void SectorBitmap::set(std::size_t sector) {
+        this->_words[sector / SectorBitmap::_WORD_BITS] |= 1ull << (sector % SectorBitmap::_WORD_BITS);
+    }
+
+    void SectorBitmap::reset(std::size_t sector) {
+        this->_words[sector / SectorBitmap::_WORD_BITS] &= ~(1ull << (sector % SectorBitmap::_WORD_BITS));
+    }
+
+    bool SectorBitmap::test(std::size_t sector) const {
+        return (this->_words[sector / SectorBitmap::_WORD_BITS] >> (sector % SectorBitmap::_WORD_BITS)) & 1u;
+    }
+
+    void SectorBitmap::clear() {
+        this->_words.fill(0);
+    }
+
+    bool SectorBitmap::any() const {
+        for (std::uint64_t word : this->_words) {
+            if (word != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::size_t SectorBitmap::count() const {
+        std::size_t count = 0;
+        for (std::uint64_t word : this->_words) {
+            count += (std::size_t)std::popcount(word);
+        }
+        return count;
+    }
+
+    std::size_t SectorBitmap::find_next(std::size_t sector) const {
+        std::size_t w = sector / SectorBitmap::_WORD_BITS;
+        if (w >= SectorBitmap::_WORD_COUNT) {
+            return SectorBitmap::SECTOR_COUNT;
+        }
+        // mask off the bits of the first word below the starting sector
+        std::uint64_t word = this->_words[w] & (~0ull << (sector % SectorBitmap::_WORD_BITS));
+        while (word == 0) {
+            if (++w == SectorBitmap::_WORD_COUNT) {
+                return SectorBitmap::SECTOR_COUNT;
+            }
+            word = this->_words[w];
+        }
+        return w * SectorBitmap::_WORD_BITS + (std::size_t)std::countr_zero(word);
+    }
+
+    SectorBitmap& SectorBitmap::operator|=(const SectorBitmap& other) {
+        for (std::size_t w = 0; w < SectorBitmap::_WORD_COUNT; w++) {
+            this->_words[w] |= other._words[w];
+        }
+        return *this;
+    }
+}
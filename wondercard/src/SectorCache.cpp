@@ -0,0 +1,124 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+
+#include <algorithm>
+#include <span>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/SectorCache.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    SectorCache::SectorCache(std::size_t capacity)
+      : _entries(std::min(capacity, MemoryCard::CARD_SECTOR_COUNT))
+      {
+        this->clear();
+    }
+
+    bool SectorCache::get(std::size_t sector, MemoryCard::Sector data) {
+        std::uint16_t entry = this->_index[sector];
+        if (entry == SectorCache::_NONE) {
+            return false;
+        }
+        std::copy(this->_entries[entry].data.begin(), this->_entries[entry].data.end(), data.begin());
+        this->_unlink(entry);
+        this->_push_front(entry);
+        return true;
+    }
+
+    void SectorCache::put(std::size_t sector, std::span<const Byte, MemoryCard::SECTOR_SIZE> data) {
+        if (this->_entries.empty()) {
+            return;
+        }
+        std::uint16_t entry = this->_index[sector];
+        if (entry != SectorCache::_NONE) {
+            this->_unlink(entry);
+        } else if (this->_free != SectorCache::_NONE) {
+            entry = this->_free;
+            this->_free = this->_entries[entry].next;
+            this->_size++;
+        } else {
+            // full, so reuse the least recently used entry
+            entry = this->_least_recent;
+            this->_unlink(entry);
+            this->_index[this->_entries[entry].sector] = SectorCache::_NONE;
+        }
+        std::copy(data.begin(), data.end(), this->_entries[entry].data.begin());
+        this->_entries[entry].sector = (std::uint16_t)sector;
+        this->_index[sector] = entry;
+        this->_push_front(entry);
+    }
+
+    void SectorCache::erase(std::size_t sector) {
+        std::uint16_t entry = this->_index[sector];
+        if (entry == SectorCache::_NONE) {
+            return;
+        }
+        this->_unlink(entry);
+        this->_index[sector] = SectorCache::_NONE;
+        this->_entries[entry].next = this->_free;
+        this->_free = entry;
+        this->_size--;
+    }
+
+    void SectorCache::clear() {
+        this->_index.fill(SectorCache::_NONE);
+        this->_most_recent = SectorCache::_NONE;
+        this->_least_recent = SectorCache::_NONE;
+        // chain all entries together into the free list
+        this->_free = this->_entries.empty() ? SectorCache::_NONE : 0;
+        for (std::size_t i = 0; i < this->_entries.size(); i++) {
+            this->_entries[i].next = i + 1 < this->_entries.size() ? (std::uint16_t)(i + 1) : SectorCache::_NONE;
+        }
+        this->_size = 0;
+    }
+
+    std::size_t SectorCache::size() const {
+        return this->_size;
+    }
+
+    std::size_t SectorCache::capacity() const {
+        return this->_entries.size();
+    }
+
+    void SectorCache::_unlink(std::uint16_t entry) {
+        Entry& unlinked = this->_entries[entry];
+        if (unlinked.previous != SectorCache::_NONE) {
+            this->_entries[unlinked.previous].next = unlinked.next;
+        } else {
+            this->_most_recent = unlinked.next;
+        }
+        if (unlinked.next != SectorCache::_NONE) {
+            this->_entries[unlinked.next].previous = unlinked.previous;
+        } else {
+            this->_least_recent = unlinked.previous;
+        }
+    }
+
+    void SectorCache::_push_front(std::uint16_t entry) {
+        this->_entries[entry].previous = SectorCache::_NONE;
+        this->_entries[entry].next = this->_most_recent;
+        if (this->_most_recent != SectorCache::_NONE) {
+            this->_entries[this->_most_recent].previous = entry;
+        } else {
+            this->_least_recent = entry;
+        }
+        this->_most_recent = entry;
+    }
+
+    const std::uint16_t SectorCache::_NONE = 0xFFFF;
+}
@@ -0,0 +1,28 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#include <span>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/SpanCardStorage.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    SpanCardStorage::SpanCardStorage(std::span<Byte, MemoryCard::CARD_SIZE> data)
+      : _data(data)
+      {}
+
+    std::span<Byte> SpanCardStorage::bytes() {
+        return this->_data;
+    }
+}
@@ -0,0 +1,116 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <istream>
+#include <ostream>
+#include <span>
+#include <vector>
+
+#include <cstddef>
+
+#include <wondercard/common.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+#include <wondercard/TraceFile.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    namespace {
+        constexpr Byte MOSI_DRIVEN = 0x01;
+        constexpr Byte MISO_DRIVEN = 0x02;
+        constexpr Byte ACKED = 0x04;
+
+        // how many records to encode or decode at once
+        constexpr std::size_t CHUNK_SIZE = 4096u;
+    }
+
+    TraceWriter::TraceWriter(std::ostream& output)
+      : _output(output)
+      {
+        this->_output.write(TraceFile::MAGIC.data(), (std::streamsize)TraceFile::MAGIC.size());
+    }
+
+    bool TraceWriter::write(std::span<const ProtocolTrace::Record> records) {
+        while (not records.empty()) {
+            std::size_t count = std::min(records.size(), CHUNK_SIZE);
+            this->_buffer.resize(count * TraceFile::RECORD_SIZE);
+            char* entry = this->_buffer.data();
+            for (const ProtocolTrace::Record& record : records.first(count)) {
+                entry[0] = (char)(
+                    (record.mosi.has_value() ? MOSI_DRIVEN : 0) |
+                    (record.miso.has_value() ? MISO_DRIVEN : 0) |
+                    (record.ack ? ACKED : 0)
+                );
+                entry[1] = (char)record.mosi.value_or(0x00);
+                entry[2] = (char)record.miso.value_or(0x00);
+                entry += TraceFile::RECORD_SIZE;
+            }
+            this->_output.write(this->_buffer.data(), (std::streamsize)this->_buffer.size());
+            records = records.subspan(count);
+        }
+        return (bool)this->_output;
+    }
+
+    TraceReader::TraceReader(std::istream& input)
+      : _input(input)
+      , _valid(false)
+      {
+        std::array<char, TraceFile::MAGIC.size()> magic = {};
+        this->_input.read(magic.data(), (std::streamsize)magic.size());
+        this->_valid = this->_input and magic == TraceFile::MAGIC;
+    }
+
+    bool TraceReader::valid() const {
+        return this->_valid;
+    }
+
+    std::size_t TraceReader::read(std::span<ProtocolTrace::Record> records) {
+        std::size_t total = 0;
+        while (this->_valid and total < records.size()) {
+            std::size_t wanted = std::min(records.size() - total, CHUNK_SIZE);
+            this->_buffer.resize(wanted * TraceFile::RECORD_SIZE);
+            this->_input.read(this->_buffer.data(), (std::streamsize)this->_buffer.size());
+            std::size_t got = (std::size_t)this->_input.gcount();
+            // a partial record at the end means the file is broken
+            if (got % TraceFile::RECORD_SIZE != 0 or (this->_input.bad())) {
+                this->_valid = false;
+            }
+            const char* entry = this->_buffer.data();
+            for (std::size_t i = 0; i < got / TraceFile::RECORD_SIZE; i++) {
+                Byte flags = (Byte)entry[0];
+                ProtocolTrace::Record& record = records[total + i];
+                record.mosi = (flags & MOSI_DRIVEN) ? TriState((Byte)entry[1]) : TriState();
+                record.miso = (flags & MISO_DRIVEN) ? TriState((Byte)entry[2]) : TriState();
+                record.ack = flags & ACKED;
+                entry += TraceFile::RECORD_SIZE;
+            }
+            total += got / TraceFile::RECORD_SIZE;
+            if (got < this->_buffer.size()) {
+                break; // end of file
+            }
+        }
+        return total;
+    }
+
+    std::vector<ProtocolTrace::Record> TraceReader::read_all() {
+        std::vector<ProtocolTrace::Record> records;
+        std::size_t count;
+        do {
+            std::size_t start = records.size();
+            records.resize(start + CHUNK_SIZE);
+            count = this->read(std::span(records).subspan(start));
+            records.resize(start + count);
+        } while (count == CHUNK_SIZE);
+        return records;
+    }
+}
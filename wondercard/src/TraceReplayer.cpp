@@ -0,0 +1,83 @@
+/**
+ * This file forms part of PS1 Memory Card Protocol, a fully virtual emulation
+ * of the protocol used by Memory Cards for the PlayStation.
+ *
+ * Copyright Joshua Saxby 2021. All rights reserved.
+ *
+ * This is closed-source software and may not be produced in either part or in
+ * full, in either source or binary form, without the express written consent
+ * of the copyright holder.
+ *
+ */
+
+#include <algorithm>
+#include <array>
+#include <span>
+
+#include <cstddef>
+
+#include <wondercard/common.hpp>
+#include <wondercard/MemoryCard.hpp>
+#include <wondercard/ProtocolTrace.hpp>
+#include <wondercard/TraceFile.hpp>
+#include <wondercard/TraceReplayer.hpp>
+
+
+namespace com::saxbophone::wondercard {
+    namespace {
+        // how many records to send to the card at once
+        constexpr std::size_t BATCH_SIZE = 1024u;
+    }
+
+    TraceReplayer::TraceReplayer(MemoryCard& card)
+      : _card(card)
+      , _result{}
+      {}
+
+    bool TraceReplayer::replay(std::span<const ProtocolTrace::Record> records) {
+        std::array<TriState, BATCH_SIZE> mosi, miso;
+        std::array<bool, BATCH_SIZE> ack;
+        while (not this->_result.diverged and not records.empty()) {
+            std::size_t count = std::min(records.size(), BATCH_SIZE);
+            for (std::size_t i = 0; i < count; i++) {
+                mosi[i] = records[i].mosi;
+            }
+            // the card leaves MISO alone when it doesn't drive it
+            std::fill_n(miso.begin(), count, TriState());
+            this->_card.transfer(
+                std::span(mosi).first(count),
+                std::span(miso).first(count),
+                std::span(ack).first(count)
+            );
+            for (std::size_t i = 0; i < count; i++) {
+                if (miso[i] != records[i].miso or ack[i] != records[i].ack) {
+                    this->_result.diverged = true;
+                    this->_result.divergence = this->_result.replayed + i;
+                    this->_result.expected = records[i];
+                    this->_result.actual = {records[i].mosi, miso[i], ack[i]};
+                    this->_result.replayed += i + 1;
+                    return false;
+                }
+            }
+            this->_result.replayed += count;
+            records = records.subspan(count);
+        }
+        return not this->_result.diverged;
+    }
+
+    bool TraceReplayer::replay(TraceReader& reader) {
+        std::array<ProtocolTrace::Record, BATCH_SIZE> records;
+        std::size_t count;
+        do {
+            count = reader.read(records);
+            if (not this->replay(std::span(records).first(count))) {
+                return false;
+            }
+        } while (count == BATCH_SIZE);
+        return reader.valid();
+    }
+
+    const TraceReplayer::Result& TraceReplayer::result() const {
+        return this->_result;
+    }
+}